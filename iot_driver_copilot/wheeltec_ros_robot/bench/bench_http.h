@@ -0,0 +1,126 @@
+// Shared pieces of the HTTP benchmarks: a blocking keep-alive client and
+// the latency summary they print.
+#pragma once
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// ================ Connection ================
+
+class Connection {
+public:
+    Connection(const std::string& host, int port) : m_host(host), m_port(port) {}
+    ~Connection() { close_fd(); }
+
+    // Sends one request and reads the whole response. Reconnects once if a
+    // kept-alive connection turns out to be closed. Returns the status code,
+    // or -1 on a transport error.
+    int exchange(const std::string& request) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (m_fd < 0 && !connect_fd()) return -1;
+            int status = try_exchange(request);
+            if (status > 0) return status;
+            close_fd();
+        }
+        return -1;
+    }
+
+    // Body of the last response.
+    const std::string& body() const { return m_body; }
+
+private:
+    bool connect_fd() {
+        m_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_fd < 0) return false;
+        int one = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(m_port);
+        if (inet_pton(AF_INET, m_host.c_str(), &addr.sin_addr) != 1 ||
+            connect(m_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close_fd();
+            return false;
+        }
+        m_buf.clear();
+        return true;
+    }
+
+    void close_fd() {
+        if (m_fd >= 0) close(m_fd);
+        m_fd = -1;
+    }
+
+    int try_exchange(const std::string& request) {
+        size_t off = 0;
+        while (off < request.size()) {
+            ssize_t n = send(m_fd, request.data() + off, request.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            off += n;
+        }
+        // Headers, then Content-Length bytes of body.
+        size_t header_end;
+        while ((header_end = m_buf.find("\r\n\r\n")) == std::string::npos)
+            if (!fill()) return -1;
+        int status = 0;
+        if (std::sscanf(m_buf.c_str(), "HTTP/1.%*d %d", &status) != 1) return -1;
+        size_t body_len = 0;
+        std::string head = m_buf.substr(0, header_end);
+        for (auto& c : head) c = std::tolower(static_cast<unsigned char>(c));
+        size_t cl = head.find("\r\ncontent-length:");
+        if (cl != std::string::npos) body_len = std::strtoul(head.c_str() + cl + 17, nullptr, 10);
+        size_t total = header_end + 4 + body_len;
+        while (m_buf.size() < total)
+            if (!fill()) return -1;
+        m_body.assign(m_buf, header_end + 4, body_len);
+        m_buf.erase(0, total);
+        if (head.find("\r\nconnection: close") != std::string::npos) close_fd();
+        return status;
+    }
+
+    bool fill() {
+        char chunk[16384];
+        for (;;) {
+            ssize_t n = recv(m_fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            m_buf.append(chunk, n);
+            return true;
+        }
+    }
+
+    std::string m_host;
+    int m_port;
+    int m_fd = -1;
+    std::string m_buf, m_body;
+};
+
+// ================ Report ================
+
+inline double percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[idx] / 1e6;
+}
+
+inline void print_latency(const char* indent, std::vector<int64_t>& v) {
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for (int64_t x : v) sum += x;
+    std::printf("%s\"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, "
+                "\"max\": %.3f, \"mean\": %.3f}",
+                indent, percentile(v, 0.5), percentile(v, 0.9), percentile(v, 0.99), percentile(v, 0.999),
+                v.empty() ? 0.0 : v.back() / 1e6, v.empty() ? 0.0 : sum / v.size() / 1e6);
+}
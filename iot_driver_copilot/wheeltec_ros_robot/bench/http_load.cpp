@@ -0,0 +1,232 @@
+// HTTP load generator for the driver: GET /status, POST /move and POST /nav
+// over keep-alive connections, with latency percentiles printed as JSON.
+//
+// With --spawn the driver is started here with WHEELTEC_FAKE_SENSORS=1 (a
+// synthetic in-process sensor feed, no ROS master needed) and killed at the
+// end; FAKE_* variables in the environment are passed through to size it.
+//
+// Closed loop (--rate 0): every connection sends its next request as soon as
+// the previous answer arrives. Open loop (--rate N): requests are scheduled at
+// N/s across all connections and latency is measured from the scheduled send
+// time, so a stalled server shows up in the tail instead of lowering the rate.
+//
+// Build (from wheeltec_ros_robot/): cmake -S . -B build && cmake --build build --target http_load
+// Usage: http_load [--host 127.0.0.1] [--port 8080] [--duration 10] [--warmup 1]
+//                  [--concurrency 8] [--rate 0] [--mix status=8,move=1,nav=1]
+//                  [--spawn path/to/driver]
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bench_http.h"
+
+using Clock = std::chrono::steady_clock;
+
+enum Op { kStatus, kMove, kNav, kOpCount };
+static const char* const kOpNames[kOpCount] = {"status", "move", "nav"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    double duration = 10;
+    double warmup = 1;
+    int concurrency = 8;
+    double rate = 0;
+    int mix[kOpCount] = {8, 1, 1};
+    std::string spawn;
+};
+
+static void usage() {
+    std::fprintf(stderr,
+                 "usage: http_load [--host H] [--port P] [--duration S] [--warmup S] [--concurrency N]\n"
+                 "                 [--rate R] [--mix status=8,move=1,nav=1] [--spawn DRIVER]\n");
+    std::exit(2);
+}
+
+static bool parse_mix(const char* s, int* mix) {
+    int parsed[kOpCount] = {0, 0, 0};
+    std::string spec(s);
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = item.substr(0, eq);
+        int op = -1;
+        for (int i = 0; i < kOpCount; ++i)
+            if (name == kOpNames[i]) op = i;
+        if (op < 0) return false;
+        parsed[op] = std::atoi(item.c_str() + eq + 1);
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    if (parsed[kStatus] + parsed[kMove] + parsed[kNav] <= 0) return false;
+    std::copy(parsed, parsed + kOpCount, mix);
+    return true;
+}
+
+static Options parse_options(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (i + 1 >= argc) usage();
+        const char* v = argv[++i];
+        if (a == "--host") o.host = v;
+        else if (a == "--port") o.port = std::atoi(v);
+        else if (a == "--duration") o.duration = std::atof(v);
+        else if (a == "--warmup") o.warmup = std::atof(v);
+        else if (a == "--concurrency") o.concurrency = std::max(1, std::atoi(v));
+        else if (a == "--rate") o.rate = std::max(0.0, std::atof(v));
+        else if (a == "--mix") { if (!parse_mix(v, o.mix)) usage(); }
+        else if (a == "--spawn") o.spawn = v;
+        else usage();
+    }
+    return o;
+}
+
+// ================ Load ================
+
+// Latency samples in nanoseconds, one vector per operation.
+struct WorkerResult {
+    std::vector<int64_t> latency[kOpCount];
+    uint64_t errors[kOpCount] = {0, 0, 0};
+};
+
+static std::string make_request(Op op, const std::string& host, uint64_t n) {
+    std::string body, path;
+    switch (op) {
+    case kStatus:
+        return "GET /status HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    case kMove:
+        path = "/move";
+        body = "{\"linear\":" + std::to_string(0.1 + (n % 5) * 0.05) + ",\"angular\":0.1}";
+        break;
+    default:
+        path = "/nav";
+        body = "{\"points\":[[0,0],[" + std::to_string(n % 16) + ",2.5]],\"algorithm\":\"astar\"}";
+        break;
+    }
+    return "POST " + path + " HTTP/1.1\r\nHost: " + host + "\r\nContent-Type: application/json\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+static void run_worker(const Options& o, int id, Clock::time_point start, Clock::time_point measure_from,
+                       Clock::time_point end, WorkerResult& out) {
+    Connection conn(o.host, o.port);
+    int weight = o.mix[kStatus] + o.mix[kMove] + o.mix[kNav];
+    // Each worker owns every concurrency-th slot of the global schedule.
+    double interval_ns = o.rate > 0 ? 1e9 * o.concurrency / o.rate : 0;
+    double offset_ns = o.rate > 0 ? 1e9 * id / o.rate : 0;
+    uint64_t seq = (uint64_t)id * 7919;
+    for (uint64_t i = 0;; ++i, ++seq) {
+        Clock::time_point scheduled = Clock::now();
+        if (interval_ns > 0) {
+            scheduled = start + std::chrono::nanoseconds((int64_t)(offset_ns + interval_ns * i));
+            if (scheduled >= end) break;
+            std::this_thread::sleep_until(scheduled);
+        } else if (scheduled >= end) {
+            break;
+        }
+        int pick = (int)(seq % weight);
+        Op op = pick < o.mix[kStatus] ? kStatus : pick < o.mix[kStatus] + o.mix[kMove] ? kMove : kNav;
+        int status = conn.exchange(make_request(op, o.host, seq));
+        Clock::time_point done = Clock::now();
+        if (scheduled < measure_from) continue;
+        if (status < 200 || status >= 300) ++out.errors[op];
+        else out.latency[op].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(done - scheduled).count());
+    }
+}
+
+// ================ Driver Process ================
+
+static bool port_open(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    bool ok = connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    close(fd);
+    return ok;
+}
+
+static pid_t spawn_driver(const Options& o) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("WHEELTEC_FAKE_SENSORS", "1", 1);
+        setenv("HTTP_SERVER_PORT", std::to_string(o.port).c_str(), 1);
+        execl(o.spawn.c_str(), o.spawn.c_str(), (char*)nullptr);
+        std::perror("exec driver");
+        _exit(127);
+    }
+    for (int i = 0; i < 100; ++i) {
+        if (port_open(o.host, o.port)) return pid;
+        if (waitpid(pid, nullptr, WNOHANG) == pid) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    std::fprintf(stderr, "driver did not start listening on port %d\n", o.port);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    std::exit(1);
+}
+
+int main(int argc, char** argv) {
+    Options o = parse_options(argc, argv);
+    pid_t driver = o.spawn.empty() ? -1 : spawn_driver(o);
+
+    std::vector<WorkerResult> results(o.concurrency);
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    Clock::time_point measure_from = start + std::chrono::nanoseconds((int64_t)(o.warmup * 1e9));
+    Clock::time_point end = measure_from + std::chrono::nanoseconds((int64_t)(o.duration * 1e9));
+    for (int i = 0; i < o.concurrency; ++i)
+        workers.emplace_back(run_worker, std::cref(o), i, start, measure_from, end, std::ref(results[i]));
+    for (auto& t : workers) t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - measure_from).count();
+
+    if (driver > 0) {
+        kill(driver, SIGTERM);
+        waitpid(driver, nullptr, 0);
+    }
+
+    std::vector<int64_t> per_op[kOpCount], all;
+    uint64_t errors[kOpCount] = {0, 0, 0}, total_errors = 0;
+    for (auto& r : results) {
+        for (int op = 0; op < kOpCount; ++op) {
+            per_op[op].insert(per_op[op].end(), r.latency[op].begin(), r.latency[op].end());
+            errors[op] += r.errors[op];
+        }
+    }
+    for (int op = 0; op < kOpCount; ++op) {
+        all.insert(all.end(), per_op[op].begin(), per_op[op].end());
+        total_errors += errors[op];
+    }
+
+    std::printf("{\n  \"config\": {\"concurrency\": %d, \"rate\": %.1f, \"duration_s\": %.1f, \"warmup_s\": %.1f, "
+                "\"mix\": {\"status\": %d, \"move\": %d, \"nav\": %d}, \"spawned_driver\": %s},\n",
+                o.concurrency, o.rate, o.duration, o.warmup, o.mix[kStatus], o.mix[kMove], o.mix[kNav],
+                driver > 0 ? "true" : "false");
+    std::printf("  \"requests\": %zu,\n  \"errors\": %llu,\n  \"elapsed_s\": %.3f,\n  \"throughput_rps\": %.1f,\n",
+                all.size(), (unsigned long long)total_errors, elapsed, all.size() / elapsed);
+    print_latency("  ", all);
+    std::printf(",\n  \"routes\": {\n");
+    for (int op = 0; op < kOpCount; ++op) {
+        std::printf("    \"%s\": {\"requests\": %zu, \"errors\": %llu, ", kOpNames[op], per_op[op].size(),
+                    (unsigned long long)errors[op]);
+        print_latency("", per_op[op]);
+        std::printf("}%s\n", op + 1 < kOpCount ? "," : "");
+    }
+    std::printf("  }\n}\n");
+    return total_errors ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+// Microbenchmark: the full /status body built as a jsoncpp tree and printed
+// with Json::FastWriter (the old path) versus written with JsonWriter.
+// Checks that both produce the same bytes, then times each.
+//
+// Build (from wheeltec_ros_robot/): cmake -S . -B build && cmake --build build --target json_writer_bench
+// Usage: json_writer_bench [iterations] [lidar beams]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <jsoncpp/json/json.h>
+#include "json_writer.h"
+
+struct Vec3 { double x, y, z; };
+struct Quat { double x, y, z, w; };
+
+// Stand-ins for the ROS messages, with the fields /status reports.
+struct Sample {
+    float battery = 12.3f;
+    Vec3 position{1.25, -0.5, 0.0}, linear{0.3, 0.0, 0.0}, angular{0.0, 0.0, 0.1};
+    Quat pose_q{0.0, 0.0, 0.0998, 0.995};
+    Quat imu_q{0.001, -0.002, 0.0998, 0.995};
+    Vec3 gyro{0.001, -0.003, 0.1}, accel{0.02, -0.01, 9.81};
+    float angle_min = -3.14159f, angle_max = 3.14159f, angle_increment, time_increment = 1e-4f;
+    float scan_time = 0.1f, range_min = 0.1f, range_max = 12.0f;
+    std::vector<float> ranges;
+    uint32_t width = 640, height = 480, step = 1920;
+    std::string encoding = "rgb8";
+    uint64_t data_len = 640 * 480 * 3;
+
+    explicit Sample(size_t beams) : angle_increment(6.28318f / beams), ranges(beams) {
+        for (size_t i = 0; i < beams; ++i) ranges[i] = 0.5f + 0.013f * (i % 700);
+        if (beams > 10) {
+            ranges[3] = std::numeric_limits<float>::infinity();
+            ranges[7] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+};
+
+std::string with_jsoncpp(const Sample& s) {
+    Json::Value root;
+    root["battery"] = s.battery;
+    root["odometry"]["x"] = s.position.x;
+    root["odometry"]["y"] = s.position.y;
+    root["odometry"]["z"] = s.position.z;
+    root["odometry"]["orientation"]["x"] = s.pose_q.x;
+    root["odometry"]["orientation"]["y"] = s.pose_q.y;
+    root["odometry"]["orientation"]["z"] = s.pose_q.z;
+    root["odometry"]["orientation"]["w"] = s.pose_q.w;
+    root["odometry"]["linear"]["x"] = s.linear.x;
+    root["odometry"]["linear"]["y"] = s.linear.y;
+    root["odometry"]["linear"]["z"] = s.linear.z;
+    root["odometry"]["angular"]["x"] = s.angular.x;
+    root["odometry"]["angular"]["y"] = s.angular.y;
+    root["odometry"]["angular"]["z"] = s.angular.z;
+    root["imu"]["orientation"]["x"] = s.imu_q.x;
+    root["imu"]["orientation"]["y"] = s.imu_q.y;
+    root["imu"]["orientation"]["z"] = s.imu_q.z;
+    root["imu"]["orientation"]["w"] = s.imu_q.w;
+    root["imu"]["angular_velocity"]["x"] = s.gyro.x;
+    root["imu"]["angular_velocity"]["y"] = s.gyro.y;
+    root["imu"]["angular_velocity"]["z"] = s.gyro.z;
+    root["imu"]["linear_acceleration"]["x"] = s.accel.x;
+    root["imu"]["linear_acceleration"]["y"] = s.accel.y;
+    root["imu"]["linear_acceleration"]["z"] = s.accel.z;
+    for (float r : s.ranges) root["lidar"]["ranges"].append(r);
+    root["lidar"]["angle_min"] = s.angle_min;
+    root["lidar"]["angle_max"] = s.angle_max;
+    root["lidar"]["angle_increment"] = s.angle_increment;
+    root["lidar"]["time_increment"] = s.time_increment;
+    root["lidar"]["scan_time"] = s.scan_time;
+    root["lidar"]["range_min"] = s.range_min;
+    root["lidar"]["range_max"] = s.range_max;
+    root["camera"]["width"] = s.width;
+    root["camera"]["height"] = s.height;
+    root["camera"]["encoding"] = s.encoding;
+    root["camera"]["step"] = s.step;
+    root["camera"]["data_len"] = (Json::UInt64)s.data_len;
+    Json::FastWriter fw;
+    return fw.write(root);
+}
+
+std::string with_writer(const Sample& s) {
+    std::string out;
+    out.reserve(1024 + 20 * s.ranges.size());
+    JsonWriter w(out);
+    auto xyz = [&w](const char* name, const Vec3& v) {
+        w.key(name);
+        w.begin_object();
+        w.key("x"); w.value(v.x);
+        w.key("y"); w.value(v.y);
+        w.key("z"); w.value(v.z);
+        w.end_object();
+    };
+    auto quaternion = [&w](const char* name, const Quat& q) {
+        w.key(name);
+        w.begin_object();
+        w.key("w"); w.value(q.w);
+        w.key("x"); w.value(q.x);
+        w.key("y"); w.value(q.y);
+        w.key("z"); w.value(q.z);
+        w.end_object();
+    };
+    w.begin_object();
+    w.key("battery"); w.value(static_cast<double>(s.battery));
+    w.key("camera");
+    w.begin_object();
+    w.key("data_len"); w.value(s.data_len);
+    w.key("encoding"); w.value(s.encoding);
+    w.key("height"); w.value(s.height);
+    w.key("step"); w.value(s.step);
+    w.key("width"); w.value(s.width);
+    w.end_object();
+    w.key("imu");
+    w.begin_object();
+    xyz("angular_velocity", s.gyro);
+    xyz("linear_acceleration", s.accel);
+    quaternion("orientation", s.imu_q);
+    w.end_object();
+    w.key("lidar");
+    w.begin_object();
+    w.key("angle_increment"); w.value(static_cast<double>(s.angle_increment));
+    w.key("angle_max"); w.value(static_cast<double>(s.angle_max));
+    w.key("angle_min"); w.value(static_cast<double>(s.angle_min));
+    w.key("range_max"); w.value(static_cast<double>(s.range_max));
+    w.key("range_min"); w.value(static_cast<double>(s.range_min));
+    w.key("ranges");
+    w.begin_array();
+    for (float r : s.ranges) w.value(static_cast<double>(r));
+    w.end_array();
+    w.key("scan_time"); w.value(static_cast<double>(s.scan_time));
+    w.key("time_increment"); w.value(static_cast<double>(s.time_increment));
+    w.end_object();
+    w.key("odometry");
+    w.begin_object();
+    xyz("angular", s.angular);
+    xyz("linear", s.linear);
+    quaternion("orientation", s.pose_q);
+    w.key("x"); w.value(s.position.x);
+    w.key("y"); w.value(s.position.y);
+    w.key("z"); w.value(s.position.z);
+    w.end_object();
+    w.end_object();
+    out += '\n';
+    return out;
+}
+
+template <typename F>
+double ns_per_call(F&& f, int iterations, size_t& sink) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) sink += f().size();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    size_t beams = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 720;
+    Sample s(beams);
+
+    std::string a = with_jsoncpp(s), b = with_writer(s);
+    if (a != b) {
+        std::fprintf(stderr, "outputs differ\njsoncpp: %s\nwriter:  %s\n", a.c_str(), b.c_str());
+        return 1;
+    }
+
+    size_t sink = 0;
+    ns_per_call([&s]() { return with_jsoncpp(s); }, iterations / 10 + 1, sink);  // warm-up
+    ns_per_call([&s]() { return with_writer(s); }, iterations / 10 + 1, sink);
+    double old_ns = ns_per_call([&s]() { return with_jsoncpp(s); }, iterations, sink);
+    double new_ns = ns_per_call([&s]() { return with_writer(s); }, iterations, sink);
+
+    std::printf("beams=%zu iterations=%d\n", beams, iterations);
+    std::printf("jsoncpp tree + FastWriter: %10.0f ns/body  %zu bytes\n", old_ns, a.size());
+    std::printf("JsonWriter:                %10.0f ns/body  %zu bytes\n", new_ns, b.size());
+    std::printf("speedup: %.1fx  (checksum %zu)\n", old_ns / new_ns, sink);
+    return 0;
+}
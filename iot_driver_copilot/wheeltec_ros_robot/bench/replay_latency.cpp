@@ -0,0 +1,248 @@
+// Sensor-to-HTTP latency: replays a bag of odometry, IMU, scan and camera
+// messages against a running driver at several speeds while HTTP clients
+// poll /status, and reports per topic how long each message took from being
+// published to the first response that carried it.
+//
+// Replayed messages are published with header.stamp set to the publish time,
+// and /status reports each section's stamp, so the first response showing a
+// newer stamp than any before gives that message's age. Run on the driver's
+// host (one clock) with use_sim_time off. Messages replaced before any poll
+// saw them are counted as unseen; at high speeds that is expected.
+//
+// Build (from wheeltec_ros_robot/, in a sourced ROS environment):
+//   cmake -S . -B build && cmake --build build --target replay_latency
+// Usage: replay_latency --bag run.bag [--speeds 1,5,10] [--pollers 4] [--poll-interval-ms 0]
+//                       [--host 127.0.0.1] [--port 8080] [--path /status] [--drain-ms 500]
+//                       [--odom /odom] [--imu /imu] [--scan /scan] [--camera /camera/rgb/image_raw]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nav_msgs/Odometry.h>
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/LaserScan.h>
+
+#include "bench_http.h"
+
+enum Topic { kOdom, kImu, kScan, kCamera, kTopicCount };
+static const char* const kTopicNames[kTopicCount] = {"odom", "imu", "scan", "camera"};
+// Section of the /status body that carries each topic.
+static const char* const kSections[kTopicCount] = {"odometry", "imu", "lidar", "camera"};
+
+struct Options {
+    std::string bag;
+    std::vector<double> speeds{1, 5, 10};
+    int pollers = 4;
+    int poll_interval_ms = 0;
+    int drain_ms = 500;
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string path = "/status";
+    std::string topics[kTopicCount] = {"/odom", "/imu", "/scan", "/camera/rgb/image_raw"};
+};
+
+static void usage() {
+    std::fprintf(stderr,
+                 "usage: replay_latency --bag FILE [--speeds 1,5,10] [--pollers N] [--poll-interval-ms MS]\n"
+                 "                      [--host H] [--port P] [--path /status] [--drain-ms MS]\n"
+                 "                      [--odom T] [--imu T] [--scan T] [--camera T]\n");
+    std::exit(2);
+}
+
+static Options parse_options(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (i + 1 >= argc) usage();
+        const char* v = argv[++i];
+        if (a == "--bag") o.bag = v;
+        else if (a == "--speeds") {
+            o.speeds.clear();
+            for (char* p = const_cast<char*>(v); *p;) {
+                double s = std::strtod(p, &p);
+                if (s <= 0) usage();
+                o.speeds.push_back(s);
+                if (*p == ',') ++p;
+                else if (*p) usage();
+            }
+        }
+        else if (a == "--pollers") o.pollers = std::max(1, std::atoi(v));
+        else if (a == "--poll-interval-ms") o.poll_interval_ms = std::max(0, std::atoi(v));
+        else if (a == "--drain-ms") o.drain_ms = std::max(0, std::atoi(v));
+        else if (a == "--host") o.host = v;
+        else if (a == "--port") o.port = std::atoi(v);
+        else if (a == "--path") o.path = v;
+        else if (a == "--odom") o.topics[kOdom] = v;
+        else if (a == "--imu") o.topics[kImu] = v;
+        else if (a == "--scan") o.topics[kScan] = v;
+        else if (a == "--camera") o.topics[kCamera] = v;
+        else usage();
+    }
+    if (o.bag.empty() || o.speeds.empty()) usage();
+    return o;
+}
+
+// ================ Observation ================
+
+struct TopicStats {
+    std::atomic<uint64_t> published{0};
+    std::mutex mutex;
+    double newest = 0;              // newest stamp any response has shown
+    std::vector<int64_t> latency;   // ns from publish to first response
+
+    void observe(double stamp, double received) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stamp <= newest) return;
+        newest = stamp;
+        latency.push_back(static_cast<int64_t>((received - stamp) * 1e9));
+    }
+};
+
+struct Run {
+    TopicStats topics[kTopicCount];
+    std::atomic<bool> polling{true};
+    std::atomic<uint64_t> polls{0}, errors{0};
+};
+
+// Finds each section's "stamp" in a /status body: the stamp belongs to the
+// section key last opened before it. Scanning instead of parsing keeps the
+// poller cheap, and jsoncpp cannot read back the 1e+9999 of an inf range.
+static void find_stamps(const std::string& body, double* stamps) {
+    size_t opened[kTopicCount];
+    for (int t = 0; t < kTopicCount; ++t) {
+        opened[t] = body.find("\"" + std::string(kSections[t]) + "\":{");
+        stamps[t] = 0;
+    }
+    for (size_t pos = body.find("\"stamp\":"); pos != std::string::npos; pos = body.find("\"stamp\":", pos + 1)) {
+        int owner = -1;
+        for (int t = 0; t < kTopicCount; ++t)
+            if (opened[t] < pos && (owner < 0 || opened[t] > opened[owner])) owner = t;
+        if (owner >= 0) stamps[owner] = std::strtod(body.c_str() + pos + 8, nullptr);
+    }
+}
+
+static void poll(const Options& o, Run& run) {
+    Connection conn(o.host, o.port);
+    std::string request = "GET " + o.path + " HTTP/1.1\r\nHost: " + o.host + "\r\n\r\n";
+    double stamps[kTopicCount];
+    while (run.polling) {
+        int status = conn.exchange(request);
+        double received = ros::Time::now().toSec();
+        ++run.polls;
+        if (status != 200) {
+            ++run.errors;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        find_stamps(conn.body(), stamps);
+        for (int t = 0; t < kTopicCount; ++t)
+            if (stamps[t] > 0) run.topics[t].observe(stamps[t], received);
+        if (o.poll_interval_ms) std::this_thread::sleep_for(std::chrono::milliseconds(o.poll_interval_ms));
+    }
+}
+
+// ================ Replay ================
+
+// Publishes `m` restamped with the current time; false if it is not an M.
+template <typename M>
+static bool republish(const rosbag::MessageInstance& m, const ros::Publisher& pub) {
+    boost::shared_ptr<M> msg = m.instantiate<M>();
+    if (!msg) return false;
+    msg->header.stamp = ros::Time::now();
+    pub.publish(msg);
+    return true;
+}
+
+static void replay(const Options& o, rosbag::Bag& bag, ros::Publisher* pubs, double speed, Run& run) {
+    std::vector<std::string> topics(o.topics, o.topics + kTopicCount);
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+    ros::Time bag_start = view.getBeginTime();
+    auto wall_start = std::chrono::steady_clock::now();
+    for (const rosbag::MessageInstance& m : view) {
+        if (!ros::ok()) break;
+        double offset = (m.getTime() - bag_start).toSec() / speed;
+        std::this_thread::sleep_until(wall_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                       std::chrono::duration<double>(offset)));
+        int t = 0;
+        while (t < kTopicCount && m.getTopic() != o.topics[t]) ++t;
+        bool ok = false;
+        switch (t) {
+        case kOdom: ok = republish<nav_msgs::Odometry>(m, pubs[t]); break;
+        case kImu: ok = republish<sensor_msgs::Imu>(m, pubs[t]); break;
+        case kScan: ok = republish<sensor_msgs::LaserScan>(m, pubs[t]); break;
+        case kCamera: ok = republish<sensor_msgs::Image>(m, pubs[t]); break;
+        default: break;
+        }
+        if (ok) ++run.topics[t].published;
+    }
+}
+
+// The driver has to be subscribed before replay starts, or the first
+// messages are lost and counted as unseen.
+static void wait_for_subscribers(const ros::Publisher* pubs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    for (int t = 0; t < kTopicCount; ++t) {
+        while (pubs[t].getNumSubscribers() == 0 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (pubs[t].getNumSubscribers() == 0)
+            std::fprintf(stderr, "warning: nothing subscribed to %s\n", pubs[t].getTopic().c_str());
+    }
+}
+
+static void print_run(const Options& o, double speed, double elapsed, Run& run, bool last) {
+    std::printf("    {\"speed\": %.1f, \"elapsed_s\": %.3f, \"polls\": %llu, \"poll_errors\": %llu, \"topics\": {\n",
+                speed, elapsed, (unsigned long long)run.polls.load(), (unsigned long long)run.errors.load());
+    for (int t = 0; t < kTopicCount; ++t) {
+        TopicStats& s = run.topics[t];
+        uint64_t published = s.published, seen = s.latency.size();
+        std::printf("      \"%s\": {\"topic\": \"%s\", \"published\": %llu, \"seen\": %llu, \"unseen\": %llu, ",
+                    kTopicNames[t], o.topics[t].c_str(), (unsigned long long)published, (unsigned long long)seen,
+                    (unsigned long long)(published > seen ? published - seen : 0));
+        print_latency("", s.latency);
+        std::printf("}%s\n", t + 1 < kTopicCount ? "," : "");
+    }
+    std::printf("    }}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+    ros::init(argc, argv, "wheeltec_replay_latency", ros::init_options::AnonymousName);
+    Options o = parse_options(argc, argv);
+    ros::NodeHandle nh;
+    ros::Publisher pubs[kTopicCount] = {
+        nh.advertise<nav_msgs::Odometry>(o.topics[kOdom], 10),
+        nh.advertise<sensor_msgs::Imu>(o.topics[kImu], 10),
+        nh.advertise<sensor_msgs::LaserScan>(o.topics[kScan], 10),
+        nh.advertise<sensor_msgs::Image>(o.topics[kCamera], 10),
+    };
+    rosbag::Bag bag;
+    bag.open(o.bag, rosbag::bagmode::Read);
+    wait_for_subscribers(pubs);
+
+    std::printf("{\n  \"bag\": \"%s\",\n  \"path\": \"%s\",\n  \"pollers\": %d,\n  \"runs\": [\n", o.bag.c_str(),
+                o.path.c_str(), o.pollers);
+    for (size_t i = 0; i < o.speeds.size() && ros::ok(); ++i) {
+        Run run;
+        std::vector<std::thread> pollers;
+        for (int p = 0; p < o.pollers; ++p) pollers.emplace_back(poll, std::cref(o), std::ref(run));
+        auto start = std::chrono::steady_clock::now();
+        replay(o, bag, pubs, o.speeds[i], run);
+        // Late messages still count once a poll picks them up.
+        std::this_thread::sleep_for(std::chrono::milliseconds(o.drain_ms));
+        run.polling = false;
+        for (auto& t : pollers) t.join();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        print_run(o, o.speeds[i], elapsed, run, i + 1 == o.speeds.size() || !ros::ok());
+        std::fflush(stdout);
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
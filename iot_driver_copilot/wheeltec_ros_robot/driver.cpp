@@ -1,5 +1,7 @@
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <thread>
@@ -11,15 +13,35 @@
 #include <functional>
 #include <atomic>
 #include <csignal>
+#include <cerrno>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <string_view>
+#include <charconv>
+#include <limits>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
 
 // Networking includes
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <ctime>
 
 // ROS
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <std_msgs/Float32.h>
 #include <sensor_msgs/Imu.h>
 #include <nav_msgs/Odometry.h>
@@ -31,322 +53,3967 @@
 
 // JSON utility
 #include <jsoncpp/json/json.h>
+#include "json_writer.h"
+
+// JPEG encoding (libjpeg-turbo)
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+
+// Response compression
+#include <zlib.h>
+
+// SIMD intrinsics for the lidar kernels
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WHEELTEC_SIMD_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WHEELTEC_SIMD_NEON 1
+#endif
 
 #define BUFFER_SIZE 65536
+#define MAX_REQUEST_SIZE (1 << 20)
+
+// ================ Utility Functions ================
+
+inline std::string getenv_default(const char* key, const char* dflt) {
+    const char* v = std::getenv(key);
+    if (v == nullptr) return std::string(dflt);
+    return std::string(v);
+}
+
+inline int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time consumed so far by the calling thread.
+inline uint64_t thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Lock-free duration accumulator: count, total and worst case in nanoseconds.
+struct LatencyStat {
+    std::atomic<uint64_t> count{0}, total_ns{0}, max_ns{0};
+
+    void record(uint64_t ns) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t prev = max_ns.load(std::memory_order_relaxed);
+        while (ns > prev && !max_ns.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+    }
+
+    Json::Value to_json() const {
+        Json::Value v;
+        uint64_t n = count.load(std::memory_order_relaxed);
+        v["count"] = (Json::UInt64)n;
+        v["avg_ns"] = (Json::UInt64)(n ? total_ns.load(std::memory_order_relaxed) / n : 0);
+        v["max_ns"] = (Json::UInt64)max_ns.load(std::memory_order_relaxed);
+        return v;
+    }
+};
+
+inline int getenv_int(const char* key, int dflt) {
+    const char* v = std::getenv(key);
+    if (v == nullptr) return dflt;
+    return std::atoi(v);
+}
+
+// ================ Metrics ================
+
+// Latency histogram with fixed buckets. Plain atomic counters, so
+// observe() is a handful of relaxed increments and never blocks.
+class Histogram {
+public:
+    // Upper bounds in nanoseconds; a final +Inf bucket is implied.
+    static constexpr uint64_t kBounds[] = {
+        50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+        10000000, 25000000, 50000000, 100000000, 250000000, 500000000, 1000000000,
+    };
+    static constexpr size_t kBuckets = sizeof(kBounds) / sizeof(kBounds[0]);
+
+    void observe(uint64_t ns) {
+        size_t i = 0;
+        while (i < kBuckets && ns > kBounds[i]) ++i;
+        m_counts[i].fetch_add(1, std::memory_order_relaxed);
+        m_sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // Prometheus histogram lines for `name` with extra `labels` ("" or
+    // `key="value"`), in seconds.
+    void write(std::string& out, const char* name, const std::string& labels) const {
+        std::string sep = labels.empty() ? "" : ",";
+        uint64_t cumulative = 0;
+        char buf[64];
+        for (size_t i = 0; i <= kBuckets; ++i) {
+            cumulative += m_counts[i].load(std::memory_order_relaxed);
+            if (i < kBuckets) std::snprintf(buf, sizeof(buf), "%g", kBounds[i] / 1e9);
+            out += std::string(name) + "_bucket{" + labels + sep + "le=\"" + (i < kBuckets ? buf : "+Inf") +
+                   "\"} " + std::to_string(cumulative) + "\n";
+        }
+        std::snprintf(buf, sizeof(buf), "%.9f", m_sum_ns.load(std::memory_order_relaxed) / 1e9);
+        std::string braces = labels.empty() ? "" : "{" + labels + "}";
+        out += std::string(name) + "_sum" + braces + " " + buf + "\n";
+        out += std::string(name) + "_count" + braces + " " + std::to_string(cumulative) + "\n";
+    }
+
+private:
+    std::atomic<uint64_t> m_counts[kBuckets + 1] = {};
+    std::atomic<uint64_t> m_sum_ns{0};
+};
+
+// Process-wide counters updated on the hot paths.
+struct ServerMetrics {
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> connections_accepted{0};
+    std::atomic<uint64_t> connections_rejected{0};
+    std::atomic<int64_t> connections_open{0};
+};
+
+ServerMetrics g_metrics;
+
+// Helpers for the Prometheus text exposition format.
+inline void prom_header(std::string& out, const char* name, const char* type, const char* help) {
+    out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+}
+
+inline void prom_sample(std::string& out, const char* name, const std::string& labels, double value) {
+    char buf[32];
+    char* end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+    out += name;
+    if (!labels.empty()) out += "{" + labels + "}";
+    out += " ";
+    out.append(buf, end - buf);
+    out += "\n";
+}
+
+// ================ HTTP Request Parser ================
+
+// Receive buffer owned by a connection. Unconsumed bytes live in
+// [head, tail); the storage grows to the largest request seen on the
+// connection and is then reused, so steady-state reads do not allocate.
+struct RecvBuffer {
+    std::vector<char> data;
+    size_t head = 0, tail = 0;
+
+    const char* begin() const { return data.data() + head; }
+    size_t size() const { return tail - head; }
+    bool empty() const { return head == tail; }
+
+    // Returns a pointer with at least `min_room` writable bytes after it
+    // (compacting or growing as needed); room() tells how much exactly.
+    char* write_ptr(size_t min_room) {
+        if (data.size() - tail < min_room && head > 0) {
+            std::memmove(data.data(), data.data() + head, size());
+            tail -= head;
+            head = 0;
+        }
+        if (data.size() - tail < min_room) data.resize(std::max(data.size() * 2, tail + min_room));
+        return data.data() + tail;
+    }
+    size_t room() const { return data.size() - tail; }
+    void commit(size_t n) { tail += n; }
+    char* mutable_begin() { return data.data() + head; }
+    void consume(size_t n) {
+        head += n;
+        if (head >= tail) head = tail = 0;
+    }
+};
+
+inline bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i])) return false;
+    return true;
+}
+
+// Case-insensitive search for a comma-separated token (e.g. "close" in a Connection header).
+inline bool header_has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (iequals(item, token)) return true;
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// Value of `name` in an application/x-www-form-urlencoded query string
+// (no percent-decoding; our parameters are plain tokens).
+inline std::string_view query_param(std::string_view query, std::string_view name) {
+    while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view kv = query.substr(0, amp);
+        size_t eq = kv.find('=');
+        if (kv.substr(0, eq) == name) return eq == std::string_view::npos ? std::string_view() : kv.substr(eq + 1);
+        if (amp == std::string_view::npos) break;
+        query.remove_prefix(amp + 1);
+    }
+    return std::string_view();
+}
+
+// Content negotiation: index of the entry in `offers` that the Accept header
+// prefers (highest q, then header order), or -1 if none is acceptable. A
+// missing Accept header, or */*, selects offers[0].
+inline int negotiate_accept(std::string_view accept, const char* const* offers, int n_offers) {
+    if (accept.empty()) return 0;
+    int best = -1;
+    double best_q = 0.0;
+    while (!accept.empty()) {
+        size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        size_t semi = item.find(';');
+        std::string_view range = item.substr(0, semi);
+        while (!range.empty() && range.front() == ' ') range.remove_prefix(1);
+        while (!range.empty() && range.back() == ' ') range.remove_suffix(1);
+        double q = 1.0;
+        if (semi != std::string_view::npos) {
+            size_t qpos = item.find("q=", semi);
+            if (qpos != std::string_view::npos) q = std::atof(std::string(item.substr(qpos + 2, 5)).c_str());
+        }
+        for (int i = 0; i < n_offers && q > best_q; ++i) {
+            std::string_view offer(offers[i]);
+            bool match = range == "*/*" || iequals(range, offer) ||
+                         (range.size() > 2 && range.substr(range.size() - 2) == "/*" &&
+                          iequals(range.substr(0, range.size() - 1), offer.substr(0, range.size() - 1)));
+            if (match) {
+                best = range == "*/*" ? 0 : i;
+                best_q = q;
+            }
+        }
+        if (comma == std::string_view::npos) break;
+        accept.remove_prefix(comma + 1);
+    }
+    return best;
+}
+
+// Content codings the server applies to cached bodies, in preference order.
+enum ContentCoding { kCodingGzip, kCodingDeflate, kCodingCount };
+const char* const g_coding_names[kCodingCount] = {"gzip", "deflate"};
+
+// The coding that an Accept-Encoding header rates highest, or -1 for identity.
+// Codings that are not named explicitly take the q of "*"; ties go to gzip.
+inline int negotiate_encoding(std::string_view accept) {
+    double q_named[kCodingCount] = {-1.0, -1.0}, q_star = -1.0;
+    while (!accept.empty()) {
+        size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        size_t semi = item.find(';');
+        std::string_view token = item.substr(0, semi);
+        while (!token.empty() && token.front() == ' ') token.remove_prefix(1);
+        while (!token.empty() && token.back() == ' ') token.remove_suffix(1);
+        double q = 1.0;
+        if (semi != std::string_view::npos) {
+            size_t qpos = item.find("q=", semi);
+            if (qpos != std::string_view::npos) q = std::atof(std::string(item.substr(qpos + 2, 5)).c_str());
+        }
+        if (token == "*") q_star = q;
+        for (int i = 0; i < kCodingCount; ++i)
+            if (iequals(token, g_coding_names[i])) q_named[i] = q;
+        if (comma == std::string_view::npos) break;
+        accept.remove_prefix(comma + 1);
+    }
+    int best = -1;
+    double best_q = 0.0;
+    for (int i = 0; i < kCodingCount; ++i) {
+        double q = q_named[i] >= 0 ? q_named[i] : q_star;
+        if (q > best_q) {
+            best = i;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+struct HttpHeader {
+    std::string_view name, value;
+};
+
+// A parsed request. All views point into the connection's RecvBuffer and are
+// valid until the request is consumed.
+struct HttpRequest {
+    static const size_t kMaxHeaders = 32;
+
+    std::string_view method, target, path, query, version, body;
+    HttpHeader headers[kMaxHeaders];
+    size_t header_count = 0;
+    size_t content_length = 0;
+    bool keep_alive = false;
+
+    std::string_view header(std::string_view name) const {
+        for (size_t i = 0; i < header_count; ++i)
+            if (iequals(headers[i].name, name)) return headers[i].value;
+        return std::string_view();
+    }
+};
+
+// Resumable request parser. parse() may be called repeatedly as more bytes
+// arrive; lines already scanned are not rescanned. Positions are kept as
+// offsets from the start of the request so they survive buffer compaction,
+// and turned into views only once the request is complete.
+class HttpParser {
+public:
+    enum class Result { Incomplete, Done, Error };
+
+    Result parse(const char* data, size_t len) {
+        m_base = data;
+        while (m_state != State::Body) {
+            const char* nl = static_cast<const char*>(std::memchr(data + m_pos, '\n', len - m_pos));
+            if (nl == nullptr) {
+                if (len > BUFFER_SIZE) {
+                    fail(431, "Request header too large");
+                    return Result::Error;
+                }
+                m_pos = len;
+                return Result::Incomplete;
+            }
+            size_t line_end = nl - data;
+            size_t line_len = line_end - m_line_start;
+            if (line_len > 0 && data[line_end - 1] == '\r') --line_len;
+            std::string_view line(data + m_line_start, line_len);
+            bool ok = m_state == State::RequestLine ? request_line(line) : header_line(line, line_end + 1);
+            if (!ok) return Result::Error;
+            m_pos = m_line_start = line_end + 1;
+        }
+        if (len - m_body_off < m_req.content_length) return Result::Incomplete;
+        finish(data);
+        return Result::Done;
+    }
+
+    const HttpRequest& request() const { return m_req; }
+    size_t consumed() const { return m_body_off + m_req.content_length; }
+    int error_status() const { return m_err_status; }
+    const char* error_message() const { return m_err_msg; }
+
+    void reset() {
+        m_state = State::RequestLine;
+        m_pos = m_line_start = m_body_off = 0;
+        m_req.header_count = 0;
+        m_req.content_length = 0;
+    }
+
+private:
+    enum class State { RequestLine, Headers, Body };
+    struct Span { size_t off, len; };
+
+    State m_state = State::RequestLine;
+    size_t m_pos = 0;         // scan position for the next '\n'
+    size_t m_line_start = 0;  // start of the line being parsed
+    size_t m_body_off = 0;    // first body byte, once headers are done
+    Span m_method{0, 0}, m_target{0, 0}, m_version{0, 0};
+    Span m_hdr[HttpRequest::kMaxHeaders][2];
+    HttpRequest m_req;
+    const char* m_base = nullptr;  // start of the request for the current parse() call
+    int m_err_status = 0;
+    const char* m_err_msg = "";
+
+    bool fail(int status, const char* msg) {
+        m_err_status = status;
+        m_err_msg = msg;
+        return false;
+    }
+
+    Span span_of(std::string_view part) const {
+        return Span{static_cast<size_t>(part.data() - m_base), part.size()};
+    }
+
+    bool request_line(std::string_view line) {
+        if (line.empty()) return true;  // tolerate CRLF between requests
+        size_t sp1 = line.find(' ');
+        size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+        if (sp2 == std::string_view::npos) return fail(400, "Malformed request line");
+        m_method = span_of(line.substr(0, sp1));
+        m_target = span_of(line.substr(sp1 + 1, sp2 - sp1 - 1));
+        m_version = span_of(line.substr(sp2 + 1));
+        if (m_method.len == 0 || m_target.len == 0 || line.substr(sp2 + 1, 5) != "HTTP/")
+            return fail(400, "Malformed request line");
+        m_state = State::Headers;
+        return true;
+    }
+
+    bool header_line(std::string_view line, size_t next_line) {
+        if (line.empty()) {
+            m_body_off = next_line;
+            m_state = State::Body;
+            return true;
+        }
+        if (line.front() == ' ' || line.front() == '\t') return fail(400, "Obsolete header folding");
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) return fail(400, "Malformed header");
+        if (m_req.header_count == HttpRequest::kMaxHeaders) return fail(431, "Too many headers");
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+
+        if (iequals(name, "Content-Length")) {
+            size_t n = 0;
+            if (value.empty()) return fail(400, "Invalid Content-Length");
+            for (char ch : value) {
+                if (ch < '0' || ch > '9') return fail(400, "Invalid Content-Length");
+                n = n * 10 + (ch - '0');
+                if (n > MAX_REQUEST_SIZE) return fail(413, "Payload too large");
+            }
+            m_req.content_length = n;
+        } else if (iequals(name, "Transfer-Encoding") && !iequals(value, "identity")) {
+            return fail(501, "Transfer-Encoding not supported");
+        }
+        m_hdr[m_req.header_count][0] = span_of(name);
+        m_hdr[m_req.header_count][1] = span_of(value);
+        ++m_req.header_count;
+        return true;
+    }
+
+    void finish(const char* data) {
+        auto view = [data](const Span& sp) { return std::string_view(data + sp.off, sp.len); };
+        m_req.method = view(m_method);
+        m_req.target = view(m_target);
+        m_req.version = view(m_version);
+        size_t q = m_req.target.find('?');
+        m_req.path = m_req.target.substr(0, q);
+        m_req.query = q == std::string_view::npos ? std::string_view() : m_req.target.substr(q + 1);
+        for (size_t i = 0; i < m_req.header_count; ++i)
+            m_req.headers[i] = HttpHeader{view(m_hdr[i][0]), view(m_hdr[i][1])};
+        m_req.body = std::string_view(data + m_body_off, m_req.content_length);
+
+        // HTTP/1.1 is persistent unless the client opts out; HTTP/1.0 only if it opts in.
+        std::string_view conn = m_req.header("Connection");
+        if (m_req.version == "HTTP/1.1") m_req.keep_alive = !header_has_token(conn, "close");
+        else m_req.keep_alive = header_has_token(conn, "keep-alive");
+    }
+};
+
+// ================ HTTP Connections ================
+
+// What the handler wants the reactor to do with the connection afterwards.
+// Detach hands the socket over to whoever the handler gave it to (e.g. the
+// stream hub): the reactor forgets it without closing it.
+enum class ConnAction { Close, KeepOpen, Detach };
+
+// Response bytes the socket did not take yet: `data` from `off` on. Holding
+// the shared body keeps it alive until the reactor has written it.
+struct PendingWrite {
+    std::shared_ptr<const std::string> data;
+    size_t off;
+};
+
+// Per-connection state owned by the reactor. A worker holds `mtx` for as long
+// as it services the connection; the idle sweeper only closes connections it
+// can lock, and a closed connection has fd == -1.
+struct Connection : std::enable_shared_from_this<Connection> {
+    int fd = -1;
+    RecvBuffer in;            // bytes received but not yet consumed by the router
+    HttpParser parser;        // state of the request at the front of `in`
+    bool keep_alive = false;  // decided per request by the router
+    // Output queued while the socket was full, oldest first. The reactor
+    // waits for EPOLLOUT and flushes it before reading the next request.
+    std::deque<PendingWrite> out;
+    bool close_after_flush = false;
+    // Set by a handler that takes over the socket; run by the reactor once
+    // it has released the fd.
+    std::function<void(int fd)> on_detach;
+    // Set after a protocol upgrade: receives all further input instead of
+    // the HTTP router. Upgraded connections are exempt from the idle sweep.
+    std::function<ConnAction(Connection&)> upgrade;
+    // Run by the reactor just before it closes the socket.
+    std::function<void()> on_close;
+    std::mutex mtx;
+    std::atomic<int64_t> last_active_ms{0};  // steady clock, read by the idle sweeper
+
+    void touch() { last_active_ms = steady_ms(); }
+};
+
+// Gather-writes `iov` (modified in place) until it is all out or the
+// non-blocking socket is full. Returns how many trailing entries are still
+// (partly) unsent, or -1 if the connection failed.
+inline int send_iov(int client_sock, iovec* iov, int count) {
+    while (count > 0 && iov->iov_len == 0) {
+        ++iov;
+        --count;
+    }
+    while (count > 0) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = std::min(count, IOV_MAX);
+        ssize_t n = sendmsg(client_sock, &msg, MSG_NOSIGNAL);
+        if (n > 0) {
+            g_metrics.bytes_sent.fetch_add(n, std::memory_order_relaxed);
+            size_t done = n;
+            while (count > 0 && done >= iov->iov_len) {
+                done -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+                iov->iov_len -= done;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return count;
+        return -1;
+    }
+    return 0;
+}
+
+// Writes `head` then `body` behind any output already queued on the
+// connection. What the socket does not take now is queued (the head by
+// value, the body by reference) for the reactor to finish, so a slow reader
+// never holds up the worker.
+inline void conn_write(Connection& conn, std::string head, std::shared_ptr<const std::string> body) {
+    size_t head_off = 0, body_off = 0;
+    if (conn.out.empty()) {
+        iovec iov[2] = {{&head[0], head.size()}, {const_cast<char*>(body->data()), body->size()}};
+        int left = send_iov(conn.fd, iov, 2);
+        if (left <= 0) {
+            if (left < 0) conn.keep_alive = false;
+            return;
+        }
+        head_off = left == 2 ? static_cast<char*>(iov[0].iov_base) - head.data() : head.size();
+        body_off = static_cast<char*>(iov[1].iov_base) - body->data();
+    }
+    if (head_off < head.size()) conn.out.push_back({std::make_shared<const std::string>(std::move(head)), head_off});
+    if (body_off < body->size()) conn.out.push_back({std::move(body), body_off});
+}
+
+inline void conn_write(Connection& conn, std::string data) {
+    static const auto empty = std::make_shared<const std::string>();
+    conn_write(conn, std::move(data), empty);
+}
+
+// Writes queued output until it is all out or the socket is full again.
+// Returns false if the connection failed.
+inline bool flush_output(Connection& conn) {
+    const int kBatch = 16;
+    while (!conn.out.empty()) {
+        iovec iov[kBatch];
+        int count = 0;
+        for (auto it = conn.out.begin(); it != conn.out.end() && count < kBatch; ++it, ++count)
+            iov[count] = {const_cast<char*>(it->data->data()) + it->off, it->data->size() - it->off};
+        int left = send_iov(conn.fd, iov, count);
+        if (left < 0) return false;
+        conn.out.erase(conn.out.begin(), conn.out.begin() + (count - left));
+        if (left > 0) {
+            PendingWrite& w = conn.out.front();
+            w.off = static_cast<const char*>(iov[count - left].iov_base) - w.data->data();
+            return true;
+        }
+    }
+    return true;
+}
+
+inline const char* connection_header(const Connection& conn) {
+    return conn.keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+}
+
+// `header` ends with "Content-Length: "; the length and Connection header are appended here.
+// The body (often a cached body shared with other requests) is written
+// behind the header in one writev, without a copy.
+inline void http_send(Connection& conn, const std::string& header, std::shared_ptr<const std::string> body) {
+    std::string head = header + std::to_string(body->size()) + connection_header(conn);
+    conn_write(conn, std::move(head), std::move(body));
+}
+
+inline void http_send(Connection& conn, const std::string& header, std::string body) {
+    http_send(conn, header, std::make_shared<const std::string>(std::move(body)));
+}
+
+inline void http_send_json(Connection& conn, const Json::Value& val) {
+    Json::FastWriter fw;
+    std::string out = fw.write(val);
+    std::string header = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: ";
+    http_send(conn, header, std::move(out));
+}
+
+inline void http_error(Connection& conn, int code, const std::string& msg) {
+    std::ostringstream oss;
+    oss << "HTTP/1.1 " << code << " ERROR\r\nContent-Type: text/plain\r\nContent-Length: " << msg.size()
+        << connection_header(conn) << msg;
+    conn_write(conn, oss.str());
+}
+
+// ================ Sensor History ================
+
+// Fixed-capacity ring of compact samples: one writer (the topic's ROS
+// callback), any number of readers, no locks. Each slot carries a sequence
+// word that is odd while the writer is filling it; a reader keeps a copy
+// only if the word is the expected even value before and after copying, so
+// overwritten or half-written slots are skipped and the writer never waits.
+// Samples are stored as relaxed atomic words so concurrent copies are
+// well-defined.
+template <typename T>
+class HistoryRing {
+    static_assert(std::is_trivially_copyable<T>::value && sizeof(T) % 8 == 0, "samples are copied as 64-bit words");
+    static const size_t kWords = sizeof(T) / 8;
+
+public:
+    // Capacity is rounded up to a power of two; call before the first push.
+    void init(size_t capacity) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        m_mask = cap - 1;
+        m_slots.reset(new Slot[cap]);
+    }
+
+    size_t capacity() const { return m_slots ? m_mask + 1 : 0; }
+    size_t bytes() const { return capacity() * sizeof(Slot); }
+
+    void push(const T& sample) {
+        if (!m_slots) return;
+        uint64_t n = m_head.load(std::memory_order_relaxed);
+        Slot& s = m_slots[n & m_mask];
+        uint64_t words[kWords];
+        std::memcpy(words, &sample, sizeof(T));
+        s.seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kWords; ++i) s.words[i].store(words[i], std::memory_order_relaxed);
+        s.seq.store(2 * n + 2, std::memory_order_release);
+        m_head.store(n + 1, std::memory_order_release);
+    }
+
+    // Appends samples with stamp > since (oldest first, at most `max`), or
+    // with since < 0 the newest `max` samples.
+    void read(double since, size_t max, std::vector<T>& out) const {
+        if (!m_slots || max == 0) return;
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t cap = m_mask + 1;
+        uint64_t n = head > cap ? head - cap : 0;
+        if (since < 0 && head - n > max) n = head - max;
+        for (; n < head && out.size() < max; ++n) {
+            T sample;
+            if (load(n, sample) && (since < 0 || sample.stamp > since)) out.push_back(sample);
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> words[kWords];
+    };
+
+    bool load(uint64_t n, T& sample) const {
+        const Slot& s = m_slots[n & m_mask];
+        uint64_t before = s.seq.load(std::memory_order_acquire);
+        if (before != 2 * n + 2) return false;
+        uint64_t words[kWords];
+        for (size_t i = 0; i < kWords; ++i) words[i] = s.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != before) return false;
+        std::memcpy(&sample, words, sizeof(T));
+        return true;
+    }
+
+    std::unique_ptr<Slot[]> m_slots;
+    uint64_t m_mask = 0;
+    std::atomic<uint64_t> m_head{0};
+};
+
+// Compact samples. stamp is the header stamp in seconds (receipt time for
+// battery, which has no header); the rest are float32. The binary form of
+// /history is these structs back to back, little-endian.
+struct BatterySample {
+    double stamp;
+    float voltage, reserved;
+};
+
+struct OdomSample {
+    double stamp;
+    float x, y, yaw, vx, vy, wz;
+};
+
+struct ImuSample {
+    double stamp;
+    float qx, qy, qz, qw, gx, gy, gz, ax, ay, az;
+};
+
+// Column layout of a sample type, for the columnar JSON form.
+struct HistoryColumn {
+    const char* name;
+    size_t offset;
+};
+
+const HistoryColumn g_battery_columns[] = {{"voltage", offsetof(BatterySample, voltage)}};
+const HistoryColumn g_odom_columns[] = {
+    {"x", offsetof(OdomSample, x)},   {"y", offsetof(OdomSample, y)},   {"yaw", offsetof(OdomSample, yaw)},
+    {"vx", offsetof(OdomSample, vx)}, {"vy", offsetof(OdomSample, vy)}, {"wz", offsetof(OdomSample, wz)},
+};
+const HistoryColumn g_imu_columns[] = {
+    {"qx", offsetof(ImuSample, qx)}, {"qy", offsetof(ImuSample, qy)}, {"qz", offsetof(ImuSample, qz)},
+    {"qw", offsetof(ImuSample, qw)}, {"gx", offsetof(ImuSample, gx)}, {"gy", offsetof(ImuSample, gy)},
+    {"gz", offsetof(ImuSample, gz)}, {"ax", offsetof(ImuSample, ax)}, {"ay", offsetof(ImuSample, ay)},
+    {"az", offsetof(ImuSample, az)},
+};
+
+struct SensorHistory {
+    HistoryRing<BatterySample> battery;
+    HistoryRing<OdomSample> odom;
+    HistoryRing<ImuSample> imu;
+
+    void init(size_t capacity) {
+        battery.init(capacity);
+        odom.init(capacity);
+        imu.init(capacity);
+    }
+
+    size_t bytes() const { return battery.bytes() + odom.bytes() + imu.bytes(); }
+};
+
+inline double stamp_or_now(const ros::Time& stamp) {
+    return stamp.isZero() ? ros::Time::now().toSec() : stamp.toSec();
+}
+
+// ================ ROS Data Handlers ================
+
+// Approximate heap footprint of a retained message.
+template <typename T>
+size_t message_bytes(const T&) { return sizeof(T); }
+inline size_t message_bytes(const sensor_msgs::LaserScan& m) {
+    return sizeof(m) + (m.ranges.capacity() + m.intensities.capacity()) * sizeof(float);
+}
+inline size_t message_bytes(const sensor_msgs::Image& m) { return sizeof(m) + m.data.capacity(); }
+
+// What a safety monitor needs from a scan, computed once per scan in
+// lidar_cb: the nearest valid return and the minimum over each of a fixed
+// number of equal angular sectors. Valid means range_min <= r <= range_max;
+// ranges of sectors without a valid return, and nearest when there is none
+// at all, are NaN.
+struct LidarSummary {
+    ros::Time stamp;
+    float angle_min = 0, sector_width = 0;
+    uint32_t beams = 0, valid = 0;
+    float nearest = std::numeric_limits<float>::quiet_NaN();
+    float nearest_angle = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> sectors;
+};
+
+inline size_t message_bytes(const LidarSummary& s) { return sizeof(s) + s.sectors.capacity() * sizeof(float); }
+
+// Latest message of one sensor, published RCU-style: the writer swaps in a
+// new immutable message and readers keep whichever one they loaded for as
+// long as they need it. The only shared critical section is the pointer swap
+// itself (a few instructions), so a slow HTTP reader never holds up a ROS
+// callback and readers always see a whole message.
+//
+// Ptr is the subscriber's T::ConstPtr, so the slot retains the message roscpp
+// already deserialized instead of copying it; the message is freed when the
+// last reader drops it. Anything that needs to modify the data must copy it.
+template <typename T>
+class SensorSlot {
+public:
+    typedef boost::shared_ptr<const T> Ptr;
+
+    void publish(Ptr msg) {
+        uint64_t t0 = steady_ns();
+        boost::atomic_store(&m_msg, std::move(msg));
+        m_version.fetch_add(1, std::memory_order_release);
+        m_last_update_ms.store(steady_ms(), std::memory_order_relaxed);
+        publish_time.record(steady_ns() - t0);
+    }
+
+    // Null until the first message arrives.
+    Ptr snapshot() const {
+        uint64_t t0 = steady_ns();
+        Ptr p = boost::atomic_load(&m_msg);
+        snapshot_time.record(steady_ns() - t0);
+        return p;
+    }
+
+    uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+    // steady_ms() of the last publish; 0 before the first message.
+    int64_t last_update_ms() const { return m_last_update_ms.load(std::memory_order_relaxed); }
+
+    // Size of the message currently held (not timed, unlike snapshot()).
+    size_t bytes() const {
+        Ptr p = boost::atomic_load(&m_msg);
+        return p ? message_bytes(*p) : 0;
+    }
+
+    // callback_delay: message receipt to callback start (spinner queueing).
+    mutable LatencyStat publish_time, snapshot_time, callback_delay;
+    // Whole subscriber callback, including stream fan-out and history.
+    Histogram callback_time;
+
+private:
+    Ptr m_msg;
+    std::atomic<uint64_t> m_version{0};
+    std::atomic<int64_t> m_last_update_ms{0};
+};
+
+// One robot's shard of the sensor state: its latest messages and sample
+// history. Each robot's callbacks write only to their own shard.
+struct RobotStatus {
+    SensorSlot<std_msgs::Float32> battery;
+    SensorSlot<nav_msgs::Odometry> odom;
+    SensorSlot<sensor_msgs::Imu> imu;
+    SensorSlot<sensor_msgs::LaserScan> lidar;
+    SensorSlot<sensor_msgs::Image> camera;
+    SensorSlot<LidarSummary> lidar_summary;
+    SensorHistory history;
+
+    // Thread CPU time spent in this robot's subscriber callbacks.
+    std::atomic<uint64_t> callback_cpu_ns{0};
+    // Set for the robot at the top-level routes, whose updates also go to
+    // stream, WebSocket and MJPEG clients.
+    bool streamed = false;
+
+    size_t message_bytes() const {
+        return battery.bytes() + odom.bytes() + imu.bytes() + lidar.bytes() + camera.bytes() + lidar_summary.bytes();
+    }
+};
+
+// Sections of the /status document, selectable with ?fields= or /status/<name>.
+enum StatusField : unsigned {
+    kFieldBattery = 1u << 0,
+    kFieldOdometry = 1u << 1,
+    kFieldImu = 1u << 2,
+    kFieldLidar = 1u << 3,
+    kFieldCamera = 1u << 4,
+    kFieldAll = (1u << 5) - 1,
+};
+
+inline unsigned status_field(std::string_view name) {
+    if (name == "battery") return kFieldBattery;
+    if (name == "odometry" || name == "odom") return kFieldOdometry;
+    if (name == "imu") return kFieldImu;
+    if (name == "lidar") return kFieldLidar;
+    if (name == "camera") return kFieldCamera;
+    return 0;
+}
+
+// Comma-separated field list; 0 if empty or any name is unknown.
+inline unsigned parse_status_fields(std::string_view list) {
+    unsigned mask = 0;
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        unsigned f = status_field(list.substr(0, comma));
+        if (f == 0) return 0;
+        mask |= f;
+        if (comma == std::string_view::npos) break;
+        list.remove_prefix(comma + 1);
+    }
+    return mask;
+}
+
+// Version of a field selection: the sum of its slots' versions, which
+// increases whenever any selected sensor updates and ignores the others.
+inline uint64_t status_version(const RobotStatus& s, unsigned fields) {
+    uint64_t v = 0;
+    if (fields & kFieldBattery) v += s.battery.version();
+    if (fields & kFieldOdometry) v += s.odom.version();
+    if (fields & kFieldImu) v += s.imu.version();
+    if (fields & kFieldLidar) v += s.lidar.version();
+    if (fields & kFieldCamera) v += s.camera.version();
+    return v;
+}
+
+// Pushes a changed section to stream subscribers; defined with the streams.
+void notify_status_update(const RobotStatus& robot, unsigned field);
+
+// Sector count of LidarSummary (LIDAR_SUMMARY_SECTORS).
+unsigned g_lidar_sectors = 8;
+const unsigned kMaxLidarSectors = 360;
+
+// Defined with the lidar kernels.
+void summarize_scan(const sensor_msgs::LaserScan& scan, unsigned sectors, LidarSummary& out);
+
+// Times a subscriber callback into its slot's histogram and charges its CPU
+// time to the robot.
+struct CallbackTimer {
+    Histogram& hist;
+    std::atomic<uint64_t>& cpu_ns;
+    uint64_t t0 = steady_ns(), cpu0 = thread_cpu_ns();
+    ~CallbackTimer() {
+        hist.observe(steady_ns() - t0);
+        cpu_ns.fetch_add(thread_cpu_ns() - cpu0, std::memory_order_relaxed);
+    }
+};
+
+// Callbacks take the MessageEvent so the time a message spent queued behind
+// other callbacks shows up in /diagnostics.
+template <typename T>
+void store_message(const RobotStatus& robot, const ros::MessageEvent<T const>& ev, SensorSlot<T>& slot,
+                   unsigned field) {
+    int64_t delay = (ros::Time::now() - ev.getReceiptTime()).toNSec();
+    slot.callback_delay.record(delay > 0 ? delay : 0);
+    slot.publish(ev.getConstMessage());
+    notify_status_update(robot, field);
+}
+
+void battery_cb(RobotStatus& robot, const ros::MessageEvent<std_msgs::Float32 const>& ev) {
+    CallbackTimer timer{robot.battery.callback_time, robot.callback_cpu_ns};
+    store_message(robot, ev, robot.battery, kFieldBattery);
+    robot.history.battery.push({ev.getReceiptTime().toSec(), ev.getConstMessage()->data, 0.0f});
+}
+void odom_cb(RobotStatus& robot, const ros::MessageEvent<nav_msgs::Odometry const>& ev) {
+    CallbackTimer timer{robot.odom.callback_time, robot.callback_cpu_ns};
+    store_message(robot, ev, robot.odom, kFieldOdometry);
+    const nav_msgs::Odometry& o = *ev.getConstMessage();
+    const auto& q = o.pose.pose.orientation;
+    float yaw = static_cast<float>(std::atan2(2.0 * (q.w * q.z + q.x * q.y), 1.0 - 2.0 * (q.y * q.y + q.z * q.z)));
+    robot.history.odom.push({stamp_or_now(o.header.stamp), (float)o.pose.pose.position.x, (float)o.pose.pose.position.y,
+                              yaw, (float)o.twist.twist.linear.x, (float)o.twist.twist.linear.y,
+                              (float)o.twist.twist.angular.z});
+}
+void imu_cb(RobotStatus& robot, const ros::MessageEvent<sensor_msgs::Imu const>& ev) {
+    CallbackTimer timer{robot.imu.callback_time, robot.callback_cpu_ns};
+    store_message(robot, ev, robot.imu, kFieldImu);
+    const sensor_msgs::Imu& i = *ev.getConstMessage();
+    robot.history.imu.push({stamp_or_now(i.header.stamp), (float)i.orientation.x, (float)i.orientation.y,
+                            (float)i.orientation.z, (float)i.orientation.w, (float)i.angular_velocity.x,
+                            (float)i.angular_velocity.y, (float)i.angular_velocity.z, (float)i.linear_acceleration.x,
+                            (float)i.linear_acceleration.y, (float)i.linear_acceleration.z});
+}
+void lidar_cb(RobotStatus& robot, const ros::MessageEvent<sensor_msgs::LaserScan const>& ev) {
+    CallbackTimer timer{robot.lidar.callback_time, robot.callback_cpu_ns};
+    // Summary first, so it is never older than the scan readers can see.
+    auto summary = boost::make_shared<LidarSummary>();
+    summarize_scan(*ev.getConstMessage(), g_lidar_sectors, *summary);
+    robot.lidar_summary.publish(std::move(summary));
+    store_message(robot, ev, robot.lidar, kFieldLidar);
+}
+void camera_cb(RobotStatus& robot, const ros::MessageEvent<sensor_msgs::Image const>& ev) {
+    CallbackTimer timer{robot.camera.callback_time, robot.callback_cpu_ns};
+    store_message(robot, ev, robot.camera, kFieldCamera);
+}
+
+// ================ Response Cache ================
+
+// Distinguishes ETags issued by different runs of the driver, since
+// versions restart from zero.
+const uint64_t g_boot_id = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+
+// `variant` tells apart representations of the same resource and version.
+inline std::string make_etag(uint64_t version, const std::string& variant) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "\"%llx-%llu", (unsigned long long)g_boot_id, (unsigned long long)version);
+    return buf + variant + "\"";
+}
+
+// True if an If-None-Match header value matches `etag` (weak comparison).
+inline bool etag_matches(std::string_view inm, const std::string& etag) {
+    while (!inm.empty()) {
+        size_t comma = inm.find(',');
+        std::string_view item = inm.substr(0, comma);
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if (item.substr(0, 2) == "W/") item.remove_prefix(2);
+        if (item == "*" || item == etag) return true;
+        if (comma == std::string_view::npos) break;
+        inm.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// zlib level for compressed responses (HTTP_COMPRESSION_LEVEL, 0 disables),
+// and the smallest body worth compressing.
+int g_compression_level = 6;
+size_t g_compression_min_bytes = 1024;
+
+// `in` as a gzip stream, or for deflate a zlib stream (RFC 9110 8.4.1.2).
+// Empty on failure.
+inline std::string compress_body(const std::string& in, int coding, int level) {
+    z_stream zs{};
+    int window_bits = coding == kCodingGzip ? 15 + 16 : 15;
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return std::string();
+    std::string out(deflateBound(&zs, in.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END ? out : std::string();
+}
+
+// A serialized response body tagged with the data version it was built
+// from. Immutable once published and shared by every reader.
+struct CachedBody {
+    uint64_t version = 0;
+    std::string etag;
+    std::shared_ptr<const std::string> body;
+
+    // `body` in `coding`, compressed by the first request that asks and
+    // shared from then on. Null if compression does not make it smaller.
+    std::shared_ptr<const std::string> encoded(int coding) const {
+        std::call_once(m_coded_once[coding], [this, coding]() {
+            auto out = std::make_shared<const std::string>(compress_body(*body, coding, g_compression_level));
+            if (!out->empty() && out->size() < body->size()) std::atomic_store(&m_coded[coding], out);
+        });
+        return std::atomic_load(&m_coded[coding]);
+    }
+
+    // Plain and compressed bytes held.
+    size_t bytes() const {
+        size_t n = body ? body->size() : 0;
+        for (int c = 0; c < kCodingCount; ++c) {
+            auto coded = std::atomic_load(&m_coded[c]);
+            if (coded) n += coded->size();
+        }
+        return n;
+    }
+
+private:
+    mutable std::once_flag m_coded_once[kCodingCount];
+    mutable std::shared_ptr<const std::string> m_coded[kCodingCount];
+};
+
+// Latest CachedBody of one resource, rebuilt at most once per version.
+// Readers that find it current just take a reference; when the version moves
+// on, one reader rebuilds while the others wait for its result.
+class VersionedBody {
+public:
+    explicit VersionedBody(std::string variant = std::string()) : m_variant(std::move(variant)) {}
+
+    template <typename Build>
+    std::shared_ptr<const CachedBody> get(uint64_t version, Build&& build) {
+        std::shared_ptr<const CachedBody> cur = std::atomic_load(&m_current);
+        if (cur && cur->version == version) return cur;
+        uint64_t t0 = steady_ns();
+        std::lock_guard<std::mutex> lk(m_build_mtx);
+        uint64_t t1 = steady_ns();
+        lock_wait.record(t1 - t0);
+        cur = std::atomic_load(&m_current);
+        if (cur && cur->version >= version) return cur;
+        auto next = std::make_shared<CachedBody>();
+        next->version = version;
+        next->etag = make_etag(version, m_variant);
+        next->body = std::make_shared<const std::string>(build());
+        cur = next;
+        std::atomic_store(&m_current, cur);
+        lock_hold.record(steady_ns() - t1);
+        return cur;
+    }
+
+    // Bytes held by the current body, 0 before the first build.
+    size_t bytes() const {
+        auto cur = std::atomic_load(&m_current);
+        return cur ? cur->bytes() : 0;
+    }
+
+    // Time spent waiting for, and holding, the rebuild lock.
+    LatencyStat lock_wait, lock_hold;
+
+private:
+    std::string m_variant;
+    std::shared_ptr<const CachedBody> m_current;
+    std::mutex m_build_mtx;
+};
+
+// Bodies for query-dependent variants (e.g. reduced lidar views), one
+// VersionedBody per variant, created on first use. Capped so arbitrary query
+// strings cannot grow it without bound; past the cap bodies are built per
+// request.
+class VariantBodies {
+public:
+    template <typename Build>
+    std::shared_ptr<const CachedBody> get(const std::string& variant, uint64_t version, Build&& build) {
+        VersionedBody* body = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            auto it = m_bodies.find(variant);
+            if (it != m_bodies.end()) {
+                body = it->second.get();
+            } else if (m_bodies.size() < kMaxVariants) {
+                body = m_bodies.emplace(variant, std::make_unique<VersionedBody>(variant)).first->second.get();
+            }
+        }
+        if (body) return body->get(version, std::forward<Build>(build));
+        auto once = std::make_shared<CachedBody>();
+        once->version = version;
+        once->etag = make_etag(version, variant);
+        once->body = std::make_shared<const std::string>(build());
+        return once;
+    }
+
+    size_t bytes() {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        size_t n = 0;
+        for (const auto& b : m_bodies) n += b.second->bytes();
+        return n;
+    }
+
+private:
+    static const size_t kMaxVariants = 64;
+    std::mutex m_mtx;
+    std::unordered_map<std::string, std::unique_ptr<VersionedBody>> m_bodies;
+};
+
+// Text bodies (JSON, CSV, ...) compress well; images and packed floats do not.
+inline bool compressible(const char* content_type) {
+    return !std::strncmp(content_type, "application/json", 16) || !std::strncmp(content_type, "text/", 5);
+}
+
+// 200 with the cached body, or 304 if the client already holds this version.
+// `extra_headers` are complete CRLF-terminated lines (e.g. "Vary: Accept\r\n").
+// Text bodies are sent gzip- or deflate-coded if Accept-Encoding allows;
+// each coding has its own ETag.
+inline void http_send_cached(Connection& conn, const HttpRequest& req, const char* content_type,
+                             const CachedBody& cached, const char* extra_headers = "") {
+    std::string extra = extra_headers;
+    int coding = -1;
+    if (g_compression_level > 0 && compressible(content_type)) {
+        extra += "Vary: Accept-Encoding\r\n";
+        if (cached.body->size() >= g_compression_min_bytes) coding = negotiate_encoding(req.header("Accept-Encoding"));
+    }
+    std::string etag = cached.etag;
+    if (coding >= 0) etag.insert(etag.size() - 1, std::string("-") + g_coding_names[coding]);
+    if (etag_matches(req.header("If-None-Match"), etag)) {
+        conn_write(conn, "HTTP/1.1 304 Not Modified\r\n" + extra + "ETag: " + etag + connection_header(conn));
+        return;
+    }
+    std::shared_ptr<const std::string> coded = coding >= 0 ? cached.encoded(coding) : nullptr;
+    if (coded) extra += std::string("Content-Encoding: ") + g_coding_names[coding] + "\r\n";
+    else etag = cached.etag;
+    std::string header = std::string("HTTP/1.1 200 OK\r\nContent-Type: ") + content_type + "\r\n" + extra +
+                         "ETag: " + etag + "\r\nCache-Control: no-cache\r\nContent-Length: ";
+    http_send(conn, header, coded ? coded : cached.body);
+}
+
+// ================ HTTP Server ================
+
+class HttpServer {
+public:
+    struct Options {
+        int backlog = 1024;         // listen(2) backlog
+        int max_connections = 1024; // accepted sockets beyond this get a 503
+        int workers = 4;            // fixed worker pool size
+        int idle_timeout_ms = 10000; // keep-alive connections idle (or readers stalled) longer are closed
+    };
+    using Handler = std::function<ConnAction(Connection&)>;
+
+    HttpServer(const std::string& host, int port, const Options& opts)
+        : m_host(host), m_port(port), m_opts(opts), m_running(false) {}
+
+    void start(Handler client_handler) {
+        m_handler = client_handler;
+        setup();
+        m_running = true;
+        for (int i = 0; i < m_opts.workers; ++i)
+            m_workers.emplace_back([this]() { worker_loop(); });
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    void stop() {
+        if (!m_running.exchange(false)) return;
+        if (m_wake_fd != -1) {
+            uint64_t one = 1;
+            ssize_t r = write(m_wake_fd, &one, sizeof(one));
+            (void)r;
+        }
+        if (m_thread.joinable()) m_thread.join();
+        m_queue_cv.notify_all();
+        for (auto& w : m_workers) if (w.joinable()) w.join();
+        m_workers.clear();
+        for (auto& kv : m_conns) close(kv.first);
+        m_conns.clear();
+        if (m_sock != -1) close(m_sock);
+        if (m_wake_fd != -1) close(m_wake_fd);
+        if (m_epfd != -1) close(m_epfd);
+        m_sock = m_wake_fd = m_epfd = -1;
+    }
+
+    ~HttpServer() { stop(); }
+
+private:
+    std::string m_host;
+    int m_port;
+    Options m_opts;
+    Handler m_handler;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+    std::vector<std::thread> m_workers;
+    int m_sock = -1;
+    int m_epfd = -1;
+    int m_wake_fd = -1;
+
+    // Ready connections waiting for a worker.
+    std::deque<std::shared_ptr<Connection>> m_queue;
+    std::mutex m_queue_mtx;
+    std::condition_variable m_queue_cv;
+
+    // All open connections, keyed by fd. Only touched under m_conns_mtx.
+    std::unordered_map<int, std::shared_ptr<Connection>> m_conns;
+    std::mutex m_conns_mtx;
+    std::atomic<int> m_active{0};
+
+    static void set_nonblocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    void setup() {
+        m_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int opt = 1;
+        setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(m_port);
+        if (bind(m_sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind failed");
+            exit(1);
+        }
+        if (listen(m_sock, m_opts.backlog) < 0) {
+            perror("listen failed");
+            exit(1);
+        }
+
+        m_epfd = epoll_create1(EPOLL_CLOEXEC);
+        m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_epfd < 0 || m_wake_fd < 0) {
+            perror("epoll setup failed");
+            exit(1);
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = nullptr;  // listening socket
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_sock, &ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &m_wake_fd;  // shutdown wakeup
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wake_fd, &ev);
+    }
+
+    // Reactor: accepts connections, hands readable (or, with a response
+    // queued, writable) ones to the pool and periodically closes keep-alive
+    // connections that went idle.
+    void run() {
+        const int kMaxEvents = 256;
+        epoll_event events[kMaxEvents];
+        int tick_ms = std::max(100, std::min(1000, m_opts.idle_timeout_ms / 2));
+        int64_t next_sweep = steady_ms() + tick_ms;
+        while (m_running) {
+            int n = epoll_wait(m_epfd, events, kMaxEvents, tick_ms);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait failed");
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                void* tag = events[i].data.ptr;
+                if (tag == nullptr) {
+                    accept_all();
+                } else if (tag == &m_wake_fd) {
+                    continue;
+                } else {
+                    // The event is only delivered while the connection sits in
+                    // m_conns, so shared_from_this() is always valid here.
+                    Connection* c = static_cast<Connection*>(tag);
+                    c->touch();
+                    {
+                        std::lock_guard<std::mutex> lk(m_queue_mtx);
+                        m_queue.push_back(c->shared_from_this());
+                    }
+                    m_queue_cv.notify_one();
+                }
+            }
+            int64_t now = steady_ms();
+            if (now >= next_sweep) {
+                sweep_idle(now);
+                next_sweep = now + tick_ms;
+            }
+        }
+    }
+
+    // Runs on the reactor thread. Connections a worker currently holds are
+    // skipped; a queued-but-unserviced one is closed here and the worker
+    // later sees fd == -1.
+    void sweep_idle(int64_t now) {
+        int64_t limit = m_opts.idle_timeout_ms;
+        std::vector<std::shared_ptr<Connection>> idle;
+        {
+            std::lock_guard<std::mutex> lk(m_conns_mtx);
+            for (auto& kv : m_conns)
+                if (now - kv.second->last_active_ms > limit) idle.push_back(kv.second);
+        }
+        for (auto& c : idle) {
+            std::unique_lock<std::mutex> lk(c->mtx, std::try_to_lock);
+            if (!lk.owns_lock() || c->fd < 0 || c->upgrade) continue;
+            if (now - c->last_active_ms <= limit) continue;
+            close_conn(c.get());
+        }
+    }
+
+    // Edge-triggered listener: drain the accept queue completely.
+    void accept_all() {
+        while (true) {
+            sockaddr_in c_addr;
+            socklen_t clen = sizeof(c_addr);
+            int client = accept4(m_sock, (sockaddr*)&c_addr, &clen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR) continue;
+                break;  // EAGAIN, or out of fds: retry on the next edge
+            }
+            if (m_active.load() >= m_opts.max_connections) {
+                static const char busy[] =
+                    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                ssize_t r = send(client, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+                (void)r;
+                close(client);
+                g_metrics.connections_rejected.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            int one = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            auto conn = std::make_shared<Connection>();
+            conn->fd = client;
+            conn->touch();
+            Connection* raw = conn.get();
+            {
+                std::lock_guard<std::mutex> lk(m_conns_mtx);
+                m_conns[client] = std::move(conn);
+            }
+            ++m_active;
+            g_metrics.connections_accepted.fetch_add(1, std::memory_order_relaxed);
+            g_metrics.connections_open.fetch_add(1, std::memory_order_relaxed);
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+            ev.data.ptr = raw;
+            if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, client, &ev) < 0) {
+                std::lock_guard<std::mutex> lk(raw->mtx);
+                close_conn(raw);
+            }
+        }
+    }
+
+    void worker_loop() {
+        while (true) {
+            std::shared_ptr<Connection> c;
+            {
+                std::unique_lock<std::mutex> lk(m_queue_mtx);
+                m_queue_cv.wait(lk, [this]() { return !m_running || !m_queue.empty(); });
+                if (!m_running) return;
+                c = m_queue.front();
+                m_queue.pop_front();
+            }
+            std::lock_guard<std::mutex> lk(c->mtx);
+            if (c->fd >= 0) service(c.get());
+        }
+    }
+
+    // Finish any queued output, drain the socket (required for edge-triggered
+    // mode), let the handler consume whatever is complete, then re-arm or
+    // close. While output is queued the connection waits for EPOLLOUT only, so
+    // no further pipelined requests are read. Called with c->mtx held.
+    void service(Connection* c) {
+        if (!c->out.empty()) {
+            if (!flush_output(*c)) {
+                close_conn(c);
+                return;
+            }
+            if (!c->out.empty()) {
+                rearm(c);
+                return;
+            }
+            if (c->close_after_flush) {
+                close_conn(c);
+                return;
+            }
+        }
+        bool peer_closed = false;
+        while (c->in.size() < MAX_REQUEST_SIZE + BUFFER_SIZE) {
+            char* dst = c->in.write_ptr(4096);
+            ssize_t n = recv(c->fd, dst, c->in.room(), 0);
+            if (n > 0) {
+                c->in.commit(n);
+                continue;
+            }
+            if (n == 0) {
+                peer_closed = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                peer_closed = true;
+            }
+            break;
+        }
+        ConnAction action = peer_closed ? ConnAction::Close : ConnAction::KeepOpen;
+        if (!c->in.empty()) action = m_handler(*c);
+        if (action == ConnAction::Detach) {
+            int fd = c->fd;
+            close_conn(c, false);
+            auto take = std::move(c->on_detach);
+            take(fd);
+            return;
+        }
+        if (action == ConnAction::Close || peer_closed) {
+            if (c->out.empty()) {
+                close_conn(c);
+                return;
+            }
+            c->close_after_flush = true;
+        }
+        c->touch();
+        rearm(c);
+    }
+
+    // Called with c->mtx held. A half-closed peer keeps EPOLLRDHUP pending,
+    // so it is left out while waiting to write; EPOLLHUP and EPOLLERR are
+    // always reported.
+    void rearm(Connection* c) {
+        epoll_event ev;
+        ev.events = c->out.empty() ? EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT : EPOLLOUT | EPOLLET | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) close_conn(c);
+    }
+
+    // Called with c->mtx held. With close_fd false the socket stays open for
+    // its new owner.
+    void close_conn(Connection* c, bool close_fd = true) {
+        int fd = c->fd;
+        c->fd = -1;
+        std::shared_ptr<Connection> owned;
+        {
+            // Unregister before close(): once the fd is released the kernel
+            // may hand the same number to the next accept().
+            std::lock_guard<std::mutex> lk(m_conns_mtx);
+            auto it = m_conns.find(fd);
+            if (it != m_conns.end()) {
+                owned = std::move(it->second);
+                m_conns.erase(it);
+            }
+        }
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        if (close_fd) {
+            if (c->on_close) c->on_close();
+            close(fd);
+        }
+        --m_active;
+        g_metrics.connections_open.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// ================ WebSocket Protocol ================
+
+// SHA-1 (FIPS 180-1), used only for the WebSocket handshake.
+inline void sha1(const void* data, size_t len, uint8_t out[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+    std::vector<uint8_t> msg(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + len);
+    uint64_t bits = static_cast<uint64_t>(len) * 8;
+    msg.push_back(0x80);
+    while (msg.size() % 64 != 56) msg.push_back(0);
+    for (int i = 7; i >= 0; --i) msg.push_back(static_cast<uint8_t>(bits >> (i * 8)));
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (uint32_t)msg[off + 4 * i] << 24 | (uint32_t)msg[off + 4 * i + 1] << 16 |
+                   (uint32_t)msg[off + 4 * i + 2] << 8 | msg[off + 4 * i + 3];
+        for (int i = 16; i < 80; ++i) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 5; ++i)
+        for (int j = 0; j < 4; ++j) out[4 * i + j] = static_cast<uint8_t>(h[i] >> (24 - 8 * j));
+}
+
+inline std::string base64_encode(const uint8_t* p, size_t n) {
+    static const char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < n; i += 3) {
+        uint32_t v = p[i] << 16 | (i + 1 < n ? p[i + 1] << 8 : 0) | (i + 2 < n ? p[i + 2] : 0);
+        out.push_back(tbl[v >> 18]);
+        out.push_back(tbl[(v >> 12) & 63]);
+        out.push_back(i + 1 < n ? tbl[(v >> 6) & 63] : '=');
+        out.push_back(i + 2 < n ? tbl[v & 63] : '=');
+    }
+    return out;
+}
+
+// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key (RFC 6455 4.2.2).
+inline std::string ws_accept_key(std::string_view key) {
+    std::string s(key);
+    s += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[20];
+    sha1(s.data(), s.size(), digest);
+    return base64_encode(digest, sizeof(digest));
+}
+
+enum WsOpcode { kWsText = 0x1, kWsBinary = 0x2, kWsClose = 0x8, kWsPing = 0x9, kWsPong = 0xA };
+
+// An unmasked, unfragmented server frame.
+inline std::shared_ptr<const std::string> ws_frame(int opcode, const char* payload, size_t len) {
+    std::string f;
+    f.reserve(len + 10);
+    f.push_back(static_cast<char>(0x80 | opcode));
+    if (len < 126) {
+        f.push_back(static_cast<char>(len));
+    } else if (len <= 0xffff) {
+        f.push_back(126);
+        f.push_back(static_cast<char>(len >> 8));
+        f.push_back(static_cast<char>(len));
+    } else {
+        f.push_back(127);
+        for (int i = 7; i >= 0; --i) f.push_back(static_cast<char>(static_cast<uint64_t>(len) >> (i * 8)));
+    }
+    f.append(payload, len);
+    return std::make_shared<const std::string>(std::move(f));
+}
+
+// ================ Telemetry Streams ================
+
+// Topics up to kTopicLidar carry JSON and can be subscribed over /stream and
+// /ws; kTopicCamera carries JPEG frames for MJPEG viewers.
+enum StreamTopic { kTopicBattery, kTopicOdom, kTopicImu, kTopicLidar, kTopicCamera, kTopicCount };
+
+const char* const g_topic_names[kTopicCount] = {"battery", "odom", "imu", "lidar", "camera"};
+
+inline int stream_topic(std::string_view name) {
+    for (int t = 0; t < kTopicCamera; ++t)
+        if (name == g_topic_names[t]) return t;
+    return -1;
+}
+
+// How events are framed on a subscriber's socket.
+enum class StreamFraming { Sse, WebSocket, Mjpeg };
+
+// A long-lived subscriber socket served by the StreamHub. Only the latest
+// undelivered event per topic is kept, so a slow client skips stale values
+// instead of accumulating a backlog. Control frames (WebSocket pongs, acks)
+// are queued in order and always go out before events.
+//
+// `slot_mtx` guards the queues publishers write into (pending, control,
+// close_by_ms) and is only held to move pointers; `io_mtx` is held by the
+// hub thread while it writes to the socket. The rest belongs to the hub
+// thread once the client is added.
+struct StreamClient {
+    int fd = -1;
+    StreamFraming framing = StreamFraming::Sse;
+    bool owns_fd = true;          // false if the reactor still owns (and closes) the socket
+    unsigned topics = 0;          // bitmask of 1 << StreamTopic
+    int64_t min_interval_ms = 0;  // per-topic rate limit, 0 = unlimited
+    std::mutex slot_mtx;
+    std::shared_ptr<const std::string> pending[kTopicCount];
+    std::deque<std::shared_ptr<const std::string>> control;
+    // Set by close_after(): once the control queue is out the socket is shut
+    // down, at the latest at this time.
+    int64_t close_by_ms = 0;
+    std::mutex io_mtx;
+    int64_t last_sent_ms[kTopicCount] = {};
+    int64_t last_write_ms = 0;
+    // Frame currently being written and how much of it is already out.
+    std::shared_ptr<const std::string> out;
+    size_t out_off = 0;
+    std::atomic<bool> closed{false};
+};
+
+// Fans telemetry events out to stream subscribers from a single writer
+// thread. Publishers only swap a shared frame into each subscriber's pending
+// slot and wake the thread; all socket I/O is non-blocking and happens on
+// the hub thread, which waits for writability with its own epoll set. The
+// client list lock is never held while writing, so a publisher waits at
+// most for another publisher's pointer swaps.
+class StreamHub {
+public:
+    static const int64_t kHeartbeatMs = 15000;
+    static const int64_t kCloseTimeoutMs = 5000;
+
+    void start(int max_clients) {
+        m_max_clients = max_clients;
+        m_epfd = epoll_create1(EPOLL_CLOEXEC);
+        m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wake_fd, &ev);
+        m_running = true;
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    void stop() {
+        if (!m_running.exchange(false)) return;
+        wake();
+        if (m_thread.joinable()) m_thread.join();
+        for (auto& c : m_clients)
+            if (c->owns_fd) close(c->fd);
+        m_clients.clear();
+        close(m_wake_fd);
+        close(m_epfd);
+    }
+
+    ~StreamHub() { stop(); }
+
+    bool has_subscribers(StreamTopic t) const { return m_subscribers[t].load(std::memory_order_relaxed) > 0; }
+
+    bool full() {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        return (int)m_clients.size() >= m_max_clients;
+    }
+
+    // Takes ownership of c->fd; c->out may already hold the response header.
+    void add(const std::shared_ptr<StreamClient>& c) {
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            c->last_write_ms = steady_ms();
+            m_clients.push_back(c);
+            for (int t = 0; t < kTopicCount; ++t)
+                if (c->topics & (1u << t)) ++m_subscribers[t];
+        }
+        epoll_event ev;
+        ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c.get();
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        wake();
+    }
+
+    // Event for topic `t` with a JSON payload, framed for `framing`.
+    static std::shared_ptr<const std::string> frame(StreamFraming framing, StreamTopic t, const std::string& json) {
+        // FastWriter output ends with a newline, which would end an SSE data field.
+        size_t len = json.size() - (!json.empty() && json.back() == '\n' ? 1 : 0);
+        std::string f;
+        f.reserve(len + 32);
+        if (framing == StreamFraming::Sse) {
+            f.append("event: ").append(g_topic_names[t]).append("\ndata: ").append(json, 0, len).append("\n\n");
+            return std::make_shared<const std::string>(std::move(f));
+        }
+        f.append("{\"topic\":\"").append(g_topic_names[t]).append("\",\"data\":").append(json, 0, len).append("}");
+        return ws_frame(kWsText, f.data(), f.size());
+    }
+
+    // Frames are built once per framing in use and shared by all subscribers.
+    void publish(StreamTopic t, const std::string& json) {
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            std::shared_ptr<const std::string> framed[2];
+            for (auto& c : m_clients) {
+                if (!(c->topics & (1u << t)) || c->framing == StreamFraming::Mjpeg) continue;
+                auto& f = framed[static_cast<int>(c->framing)];
+                if (!f) f = frame(c->framing, t, json);
+                std::lock_guard<std::mutex> slot(c->slot_mtx);
+                c->pending[t] = f;
+            }
+        }
+        wake();
+    }
+
+    // An already framed event for the subscribers that use `framing`.
+    void publish_framed(StreamTopic t, StreamFraming framing, const std::shared_ptr<const std::string>& frame) {
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            for (auto& c : m_clients) {
+                if (!(c->topics & (1u << t)) || c->framing != framing) continue;
+                std::lock_guard<std::mutex> slot(c->slot_mtx);
+                c->pending[t] = frame;
+            }
+        }
+        wake();
+    }
+
+    void send_control(const std::shared_ptr<StreamClient>& c, std::shared_ptr<const std::string> frame) {
+        {
+            std::lock_guard<std::mutex> slot(c->slot_mtx);
+            c->control.push_back(std::move(frame));
+        }
+        wake();
+    }
+
+    // Queues a final control frame (a WebSocket close) behind the ones already
+    // queued and drops pending events. Once it is out, or after
+    // kCloseTimeoutMs, the hub shuts the socket down; the owner sees EOF and
+    // closes it.
+    void close_after(const std::shared_ptr<StreamClient>& c, std::shared_ptr<const std::string> frame) {
+        {
+            std::lock_guard<std::mutex> slot(c->slot_mtx);
+            if (c->close_by_ms) return;
+            c->control.push_back(std::move(frame));
+            for (auto& p : c->pending) p.reset();
+            c->close_by_ms = steady_ms() + kCloseTimeoutMs;
+        }
+        wake();
+    }
+
+    bool closing(const std::shared_ptr<StreamClient>& c) {
+        std::lock_guard<std::mutex> slot(c->slot_mtx);
+        return c->close_by_ms != 0;
+    }
+
+    // For clients with owns_fd == false: once this returns the hub no longer
+    // touches the socket, so the owner may close it.
+    void remove(const std::shared_ptr<StreamClient>& c) {
+        c->closed = true;
+        std::lock_guard<std::mutex> io(c->io_mtx);  // waits out a write in progress
+        std::lock_guard<std::mutex> lk(m_mtx);
+        remove_closed();
+    }
+
+    size_t client_count() {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        return m_clients.size();
+    }
+
+private:
+    int m_max_clients = 0;
+    std::mutex m_mtx;  // guards m_clients; lock order is io_mtx, m_mtx, slot_mtx
+    std::vector<std::shared_ptr<StreamClient>> m_clients;
+    std::atomic<int> m_subscribers[kTopicCount] = {};
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+    int m_epfd = -1;
+    int m_wake_fd = -1;
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t r = write(m_wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+
+    void run() {
+        const int kMaxEvents = 64;
+        epoll_event events[kMaxEvents];
+        std::vector<std::shared_ptr<StreamClient>> clients;
+        int timeout_ms = -1;
+        while (m_running) {
+            int n = epoll_wait(m_epfd, events, kMaxEvents, timeout_ms);
+            {
+                std::lock_guard<std::mutex> lk(m_mtx);
+                clients = m_clients;
+            }
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.ptr == nullptr) {
+                    uint64_t v;
+                    ssize_t r = read(m_wake_fd, &v, sizeof(v));
+                    (void)r;
+                } else if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                    // The event may belong to a client removed since; only
+                    // clients still listed are live.
+                    for (auto& c : clients)
+                        if (c.get() == events[i].data.ptr) c->closed = true;
+                }
+            }
+            int64_t now = steady_ms();
+            int64_t next_due = now + kHeartbeatMs;
+            for (auto& c : clients)
+                if (!c->closed) flush(*c, now, next_due);
+            clients.clear();
+            {
+                std::lock_guard<std::mutex> lk(m_mtx);
+                remove_closed();
+            }
+            timeout_ms = static_cast<int>(std::max<int64_t>(1, next_due - now));
+        }
+    }
+
+    // Write as much as the socket takes: the frame in progress, then due
+    // pending events, then a heartbeat comment if the stream went quiet.
+    void flush(StreamClient& c, int64_t now, int64_t& next_due) {
+        std::lock_guard<std::mutex> io(c.io_mtx);
+        while (!c.closed) {
+            if (c.out) {
+                const std::string& f = *c.out;
+                ssize_t n = send(c.fd, f.data() + c.out_off, f.size() - c.out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;  // EPOLLOUT edge resumes us
+                    if (errno != EINTR) c.closed = true;
+                    continue;
+                }
+                g_metrics.bytes_sent.fetch_add(n, std::memory_order_relaxed);
+                c.out_off += n;
+                if (c.out_off < f.size()) break;
+                c.out.reset();
+                c.last_write_ms = now;
+            }
+            if (!next_frame(c, now, next_due)) return;
+            c.out_off = 0;
+        }
+        std::lock_guard<std::mutex> slot(c.slot_mtx);
+        if (c.close_by_ms) {
+            if (now >= c.close_by_ms) c.closed = true;
+            else next_due = std::min(next_due, c.close_by_ms);
+        }
+    }
+
+    // Moves the next frame to send into c.out: a control frame, a due
+    // pending event or a heartbeat. False if there is nothing to send yet;
+    // a closing client is marked closed once its control queue is out.
+    bool next_frame(StreamClient& c, int64_t now, int64_t& next_due) {
+        std::lock_guard<std::mutex> slot(c.slot_mtx);
+        if (!c.control.empty()) {
+            c.out = std::move(c.control.front());
+            c.control.pop_front();
+            return true;
+        }
+        if (c.close_by_ms) {
+            c.closed = true;
+            return false;
+        }
+        int due = -1;
+        for (int t = 0; t < kTopicCount && due < 0; ++t) {
+            if (!c.pending[t]) continue;
+            int64_t ready_at = c.last_sent_ms[t] + c.min_interval_ms;
+            if (ready_at <= now) due = t;
+            else next_due = std::min(next_due, ready_at);
+        }
+        if (due >= 0) {
+            c.out = std::move(c.pending[due]);
+            c.last_sent_ms[due] = now;
+        } else if (c.framing != StreamFraming::Mjpeg && now - c.last_write_ms >= kHeartbeatMs) {
+            static const auto sse_heartbeat = std::make_shared<const std::string>(": keepalive\n\n");
+            static const auto ws_heartbeat = ws_frame(kWsPing, "", 0);
+            c.out = c.framing == StreamFraming::Sse ? sse_heartbeat : ws_heartbeat;
+        } else {
+            if (c.framing != StreamFraming::Mjpeg) next_due = std::min(next_due, c.last_write_ms + kHeartbeatMs);
+            return false;
+        }
+        return true;
+    }
+
+    // Called with m_mtx held. A socket the reactor owns is only shut down
+    // here (after leaving the epoll set), so the reactor sees EOF and closes
+    // it; until then the fd number cannot be reused.
+    void remove_closed() {
+        auto it = std::remove_if(m_clients.begin(), m_clients.end(), [this](const std::shared_ptr<StreamClient>& c) {
+            if (!c->closed) return false;
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+            if (c->owns_fd) close(c->fd);
+            else shutdown(c->fd, SHUT_RDWR);
+            for (int t = 0; t < kTopicCount; ++t)
+                if (c->topics & (1u << t)) --m_subscribers[t];
+            return true;
+        });
+        m_clients.erase(it, m_clients.end());
+    }
+};
+
+StreamHub g_streams;
+
+// ================ Lidar Kernels ================
+
+// Reduced views of a scan for previews: every Nth beam or the minimum over
+// N-beam bins, and ranges quantized to uint16 millimetres. Built lazily on
+// the reader side and cached per view, so lidar_cb never pays for them.
+//
+// The contiguous kernels (bin minimum, quantization, the in-range minimum
+// behind LidarSummary) have SSE2/AVX2 and NEON paths. AVX2 is picked at run
+// time so the binary still runs on any x86-64; the stride pick is a gather
+// and is left to the compiler.
+
+// Quantized sentinels: no valid return (NaN, -inf, negative) and out of
+// range (+inf or beyond 65.534 m). Real ranges are clamped to [1, 65534] mm.
+const uint16_t kRangeMmInvalid = 0;
+const uint16_t kRangeMmFar = 0xffff;
+
+inline uint16_t quantize_mm(float r) {
+    if (!(r >= 0.0f)) return kRangeMmInvalid;
+    float f = std::min(std::max(r * 1000.0f + 0.5f, 1.0f), 65535.0f);
+    return static_cast<uint16_t>(f);
+}
+
+// Minimum of a bin, ignoring NaN; NaN only if every beam is NaN.
+inline float bin_min_scalar(const float* p, size_t n) {
+    float m = std::numeric_limits<float>::quiet_NaN();
+    for (size_t i = 0; i < n; ++i)
+        if (p[i] < m || m != m) m = p[i];
+    return m;
+}
+
+// Minimum of the ranges in [lo, hi] and how many there are; +inf if none.
+// NaN fails both comparisons, so it is never counted.
+inline float valid_min_scalar(const float* p, size_t n, float lo, float hi, uint32_t& count) {
+    float m = std::numeric_limits<float>::infinity();
+    uint32_t c = 0;
+    for (size_t i = 0; i < n; ++i)
+        if (p[i] >= lo && p[i] <= hi) {
+            ++c;
+            m = std::min(m, p[i]);
+        }
+    count = c;
+    return m;
+}
+
+#ifdef WHEELTEC_SIMD_X86
+inline float valid_min_sse2(const float* p, size_t n, float lo, float hi, uint32_t& count) {
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    const __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+    __m128 acc = inf;
+    uint32_t c = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(p + i);
+        __m128 in = _mm_and_ps(_mm_cmpge_ps(x, vlo), _mm_cmple_ps(x, vhi));
+        c += __builtin_popcount(_mm_movemask_ps(in));
+        acc = _mm_min_ps(acc, _mm_or_ps(_mm_and_ps(in, x), _mm_andnot_ps(in, inf)));
+    }
+    acc = _mm_min_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_min_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t tail;
+    float m = std::min(_mm_cvtss_f32(acc), valid_min_scalar(p + i, n - i, lo, hi, tail));
+    count = c + tail;
+    return m;
+}
+
+inline float bin_min_sse2(const float* p, size_t n) {
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128 acc = inf, seen = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(p + i);
+        __m128 ord = _mm_cmpord_ps(x, x);
+        seen = _mm_or_ps(seen, ord);
+        acc = _mm_min_ps(acc, _mm_or_ps(_mm_and_ps(ord, x), _mm_andnot_ps(ord, inf)));
+    }
+    acc = _mm_min_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_min_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    float m = _mm_cvtss_f32(acc);
+    bool any = _mm_movemask_ps(seen) != 0;
+    for (; i < n; ++i)
+        if (p[i] == p[i]) {
+            any = true;
+            m = std::min(m, p[i]);
+        }
+    return any ? m : std::numeric_limits<float>::quiet_NaN();
+}
+
+void quantize_mm_sse2(const float* in, uint16_t* out, size_t n) {
+    const __m128 scale = _mm_set1_ps(1000.0f), half = _mm_set1_ps(0.5f);
+    const __m128 lo = _mm_set1_ps(1.0f), hi = _mm_set1_ps(65535.0f), zero = _mm_setzero_ps();
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i q[2];
+        for (int k = 0; k < 2; ++k) {
+            __m128 r = _mm_loadu_ps(in + i + 4 * k);
+            __m128 valid = _mm_cmpge_ps(r, zero);  // false for NaN and negatives
+            __m128 f = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(r, scale), half), lo), hi);
+            q[k] = _mm_sub_epi32(_mm_cvttps_epi32(_mm_and_ps(valid, f)), bias);
+        }
+        // SSE2 has no unsigned 32->16 pack: bias into signed range, pack, unbias.
+        __m128i packed = _mm_add_epi16(_mm_packs_epi32(q[0], q[1]), bias16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    for (; i < n; ++i) out[i] = quantize_mm(in[i]);
+}
+
+__attribute__((target("avx2,fma"))) void quantize_mm_avx2(const float* in, uint16_t* out, size_t n) {
+    const __m256 scale = _mm256_set1_ps(1000.0f), half = _mm256_set1_ps(0.5f);
+    const __m256 lo = _mm256_set1_ps(1.0f), hi = _mm256_set1_ps(65535.0f), zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i q[2];
+        for (int k = 0; k < 2; ++k) {
+            __m256 r = _mm256_loadu_ps(in + i + 8 * k);
+            __m256 valid = _mm256_cmp_ps(r, zero, _CMP_GE_OQ);
+            __m256 f = _mm256_min_ps(_mm256_max_ps(_mm256_fmadd_ps(r, scale, half), lo), hi);
+            q[k] = _mm256_cvttps_epi32(_mm256_and_ps(valid, f));
+        }
+        // packus works per 128-bit lane; restore element order afterwards.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(q[0], q[1]), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    quantize_mm_sse2(in + i, out + i, n - i);
+}
+
+inline bool have_avx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return avx2;
+}
+#endif
+
+#ifdef WHEELTEC_SIMD_NEON
+inline float valid_min_neon(const float* p, size_t n, float lo, float hi, uint32_t& count) {
+    const float32x4_t inf = vdupq_n_f32(std::numeric_limits<float>::infinity());
+    const float32x4_t vlo = vdupq_n_f32(lo), vhi = vdupq_n_f32(hi);
+    float32x4_t acc = inf;
+    uint32x4_t cnt = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vld1q_f32(p + i);
+        uint32x4_t in = vandq_u32(vcgeq_f32(x, vlo), vcleq_f32(x, vhi));
+        cnt = vsubq_u32(cnt, in);  // in-range lanes are all ones, i.e. -1
+        acc = vminq_f32(acc, vbslq_f32(in, x, inf));
+    }
+    float32x2_t m2 = vpmin_f32(vget_low_f32(acc), vget_high_f32(acc));
+    uint32x2_t c2 = vpadd_u32(vget_low_u32(cnt), vget_high_u32(cnt));
+    uint32_t tail;
+    float m = std::min(vget_lane_f32(vpmin_f32(m2, m2), 0), valid_min_scalar(p + i, n - i, lo, hi, tail));
+    count = vget_lane_u32(c2, 0) + vget_lane_u32(c2, 1) + tail;
+    return m;
+}
+
+inline float bin_min_neon(const float* p, size_t n) {
+    const float32x4_t inf = vdupq_n_f32(std::numeric_limits<float>::infinity());
+    float32x4_t acc = inf;
+    uint32x4_t seen = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vld1q_f32(p + i);
+        uint32x4_t ord = vceqq_f32(x, x);
+        seen = vorrq_u32(seen, ord);
+        acc = vminq_f32(acc, vbslq_f32(ord, x, inf));
+    }
+    float32x2_t m2 = vpmin_f32(vget_low_f32(acc), vget_high_f32(acc));
+    float m = vget_lane_f32(vpmin_f32(m2, m2), 0);
+    uint32x2_t s2 = vorr_u32(vget_low_u32(seen), vget_high_u32(seen));
+    bool any = (vget_lane_u32(s2, 0) | vget_lane_u32(s2, 1)) != 0;
+    for (; i < n; ++i)
+        if (p[i] == p[i]) {
+            any = true;
+            m = std::min(m, p[i]);
+        }
+    return any ? m : std::numeric_limits<float>::quiet_NaN();
+}
+
+void quantize_mm_neon(const float* in, uint16_t* out, size_t n) {
+    const float32x4_t scale = vdupq_n_f32(1000.0f), half = vdupq_n_f32(0.5f);
+    const float32x4_t lo = vdupq_n_f32(1.0f), hi = vdupq_n_f32(65535.0f), zero = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint16x4_t q[2];
+        for (int k = 0; k < 2; ++k) {
+            float32x4_t r = vld1q_f32(in + i + 4 * k);
+            uint32x4_t valid = vcgeq_f32(r, zero);
+            float32x4_t f = vminq_f32(vmaxq_f32(vmlaq_f32(half, r, scale), lo), hi);
+            q[k] = vmovn_u32(vandq_u32(valid, vcvtq_u32_f32(f)));
+        }
+        vst1q_u16(out + i, vcombine_u16(q[0], q[1]));
+    }
+    for (; i < n; ++i) out[i] = quantize_mm(in[i]);
+}
+#endif
+
+inline float bin_min(const float* p, size_t n) {
+#if defined(WHEELTEC_SIMD_X86)
+    return bin_min_sse2(p, n);
+#elif defined(WHEELTEC_SIMD_NEON)
+    return bin_min_neon(p, n);
+#else
+    return bin_min_scalar(p, n);
+#endif
+}
+
+inline float valid_min(const float* p, size_t n, float lo, float hi, uint32_t& count) {
+#if defined(WHEELTEC_SIMD_X86)
+    return valid_min_sse2(p, n, lo, hi, count);
+#elif defined(WHEELTEC_SIMD_NEON)
+    return valid_min_neon(p, n, lo, hi, count);
+#else
+    return valid_min_scalar(p, n, lo, hi, count);
+#endif
+}
+
+void quantize_ranges_mm(const float* in, uint16_t* out, size_t n) {
+#if defined(WHEELTEC_SIMD_X86)
+    if (have_avx2()) quantize_mm_avx2(in, out, n);
+    else quantize_mm_sse2(in, out, n);
+#elif defined(WHEELTEC_SIMD_NEON)
+    quantize_mm_neon(in, out, n);
+#else
+    for (size_t i = 0; i < n; ++i) out[i] = quantize_mm(in[i]);
+#endif
+}
+
+// Sector k covers beams [k*n/S, (k+1)*n/S). One vector pass per sector
+// gives its minimum and valid count; the nearest return is then searched
+// for only inside the sector that holds it.
+void summarize_scan(const sensor_msgs::LaserScan& scan, unsigned sectors, LidarSummary& out) {
+    const size_t n = scan.ranges.size();
+    const float* r = scan.ranges.data();
+    out.stamp = scan.header.stamp;
+    out.angle_min = scan.angle_min;
+    out.sector_width = scan.angle_increment * n / sectors;
+    out.beams = static_cast<uint32_t>(n);
+    out.valid = 0;
+    out.sectors.assign(sectors, std::numeric_limits<float>::quiet_NaN());
+    float nearest = std::numeric_limits<float>::infinity();
+    size_t nearest_sector = 0;
+    for (unsigned k = 0; k < sectors; ++k) {
+        size_t begin = n * k / sectors, end = n * (k + 1) / sectors;
+        uint32_t count;
+        float m = valid_min(r + begin, end - begin, scan.range_min, scan.range_max, count);
+        out.valid += count;
+        if (!count) continue;
+        out.sectors[k] = m;
+        if (m < nearest) {
+            nearest = m;
+            nearest_sector = k;
+        }
+    }
+    if (!out.valid) {
+        out.nearest = out.nearest_angle = std::numeric_limits<float>::quiet_NaN();
+        return;
+    }
+    size_t i = n * nearest_sector / sectors;
+    while (r[i] != nearest) ++i;
+    out.nearest = nearest;
+    out.nearest_angle = scan.angle_min + scan.angle_increment * i;
+}
+
+// A view requested with ?decimate=N&bin=stride|min&units=m|mm.
+struct ScanView {
+    unsigned decimate = 1;
+    bool bin_min = false;
+    bool mm = false;
+
+    bool identity() const { return decimate == 1 && !mm; }
+
+    // Cache and ETag suffix, e.g. "-d4min-mm".
+    std::string key() const {
+        std::string k;
+        if (decimate > 1) k += "-d" + std::to_string(decimate) + (bin_min ? "min" : "");
+        if (mm) k += "-mm";
+        return k;
+    }
+};
+
+const unsigned kMaxDecimate = 256;
+
+// False if a parameter is present but invalid.
+bool parse_scan_view(std::string_view query, ScanView& view) {
+    std::string_view d = query_param(query, "decimate");
+    if (!d.empty()) {
+        int n = std::atoi(std::string(d).c_str());
+        if (n < 1 || n > (int)kMaxDecimate) return false;
+        view.decimate = n;
+    }
+    std::string_view bin = query_param(query, "bin");
+    if (bin == "min") view.bin_min = true;
+    else if (!bin.empty() && bin != "stride") return false;
+    std::string_view units = query_param(query, "units");
+    if (units == "mm") view.mm = true;
+    else if (!units.empty() && units != "m") return false;
+    return true;
+}
+
+// A scan reduced to `view`. With mm, `scan.ranges` is empty and the
+// quantized ranges are in `ranges_mm`.
+struct ScanViewData {
+    sensor_msgs::LaserScan scan;
+    std::vector<uint16_t> ranges_mm;
+};
+
+void make_scan_view(const sensor_msgs::LaserScan& in, const ScanView& view, ScanViewData& out) {
+    sensor_msgs::LaserScan& s = out.scan;
+    s.header = in.header;
+    s.angle_min = in.angle_min;
+    s.time_increment = in.time_increment * view.decimate;
+    s.angle_increment = in.angle_increment * view.decimate;
+    s.scan_time = in.scan_time;
+    s.range_min = in.range_min;
+    s.range_max = in.range_max;
+
+    const size_t n = in.ranges.size(), step = view.decimate;
+    const size_t bins = (n + step - 1) / step;
+    s.ranges.resize(bins);
+    if (step == 1) {
+        std::copy(in.ranges.begin(), in.ranges.end(), s.ranges.begin());
+    } else if (view.bin_min) {
+        for (size_t b = 0; b < bins; ++b)
+            s.ranges[b] = bin_min(&in.ranges[b * step], std::min(step, n - b * step));
+    } else {
+        for (size_t b = 0; b < bins; ++b) s.ranges[b] = in.ranges[b * step];
+    }
+    // Beam b covers the angle of its first source beam.
+    s.angle_max = bins ? in.angle_min + s.angle_increment * (bins - 1) : in.angle_max;
+
+    if (view.mm) {
+        out.ranges_mm.resize(bins);
+        quantize_ranges_mm(s.ranges.data(), out.ranges_mm.data(), bins);
+        s.ranges.clear();
+    }
+}
+
+// ================ Velocity Commands ================
+
+// Latest-wins teleop command. /move and /ws only overwrite the slot; one
+// thread publishes it to /cmd_vel at a fixed rate, so a burst of requests
+// cannot flood the base controller. If no command arrives within the
+// deadman timeout the thread publishes a single zero twist and goes quiet
+// until the next command, so a dropped client cannot leave the robot moving.
+class VelocityCoalescer {
+public:
+    void start(ros::Publisher pub, double rate_hz, int deadman_ms) {
+        m_pub = pub;
+        m_period = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / rate_hz));
+        m_deadman_ms = deadman_ms;
+        m_running = true;
+        m_thread = std::thread(&VelocityCoalescer::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            m_running = false;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    // Lock-free; wakes the publisher only when it is idle, so the first
+    // command after a pause goes out immediately.
+    void submit(double linear, double angular) {
+        float v[2] = {static_cast<float>(linear), static_cast<float>(angular)};
+        uint64_t packed;
+        std::memcpy(&packed, v, sizeof(packed));
+        m_cmd.store(packed, std::memory_order_relaxed);
+        m_last_cmd_ms.store(steady_ms(), std::memory_order_relaxed);
+        m_released.store(false, std::memory_order_relaxed);
+        m_submitted.fetch_add(1, std::memory_order_release);
+        if (!m_active.load(std::memory_order_acquire)) {
+            // Taking the lock orders this against the publisher's idle check.
+            { std::lock_guard<std::mutex> lk(m_mtx); }
+            m_cv.notify_one();
+        }
+    }
+
+    // Stops republishing the current command without the deadman zero, for
+    // when something else (a trajectory) takes over /cmd_vel.
+    void release() { m_released.store(true, std::memory_order_relaxed); }
+
+    // coalesced: commands overwritten before a tick published them.
+    Json::Value to_json() const {
+        uint64_t submitted = m_submitted.load(), fresh = m_fresh.load();
+        Json::Value v;
+        v["submitted"] = (Json::UInt64)submitted;
+        v["published"] = (Json::UInt64)m_published.load();
+        v["coalesced"] = (Json::UInt64)(submitted > fresh ? submitted - fresh : 0);
+        v["deadman_stops"] = (Json::UInt64)m_deadman_stops.load();
+        return v;
+    }
+
+private:
+    void run() {
+        uint64_t seen = 0;
+        auto next = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lk(m_mtx);
+        while (m_running) {
+            uint64_t submitted = m_submitted.load(std::memory_order_acquire);
+            bool active = m_active.load(std::memory_order_relaxed);
+            if (!active && submitted == seen) {
+                m_cv.wait(lk);
+                next = std::chrono::steady_clock::now();
+                continue;
+            }
+            if (m_released.exchange(false, std::memory_order_relaxed)) {
+                m_active.store(false, std::memory_order_release);
+                seen = submitted;
+                continue;
+            }
+            lk.unlock();
+            geometry_msgs::Twist msg;
+            if (steady_ms() - m_last_cmd_ms.load(std::memory_order_relaxed) > m_deadman_ms) {
+                m_active.store(false, std::memory_order_release);
+                m_deadman_stops.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                uint64_t packed = m_cmd.load(std::memory_order_relaxed);
+                float v[2];
+                std::memcpy(v, &packed, sizeof(v));
+                msg.linear.x = v[0];
+                msg.angular.z = v[1];
+                m_active.store(true, std::memory_order_release);
+                if (submitted != seen) m_fresh.fetch_add(1, std::memory_order_relaxed);
+            }
+            seen = submitted;
+            if (m_pub) m_pub.publish(msg);
+            m_published.fetch_add(1, std::memory_order_relaxed);
+            lk.lock();
+            next += m_period;
+            m_cv.wait_until(lk, next, [this]() { return !m_running; });
+        }
+    }
+
+    ros::Publisher m_pub;
+    std::chrono::nanoseconds m_period{50000000};
+    int64_t m_deadman_ms = 500;
+    std::atomic<uint64_t> m_cmd{0};
+    std::atomic<int64_t> m_last_cmd_ms{0};
+    std::atomic<bool> m_active{false}, m_released{false};
+    // fresh: distinct commands that reached /cmd_vel.
+    std::atomic<uint64_t> m_submitted{0}, m_fresh{0}, m_published{0}, m_deadman_stops{0};
+    bool m_running = false;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+};
+
+// Scripted velocity profile: samples at offsets from the start, published on
+// their own thread against absolute CLOCK_MONOTONIC deadlines (timerfd with
+// TFD_TIMER_ABSTIME), so neither network nor scheduling jitter accumulates
+// across samples. A new trajectory replaces the running one; cancel and
+// completion publish a zero twist.
+struct TrajectorySample {
+    double t, linear, angular;
+};
+
+struct Trajectory {
+    enum State { kPending, kRunning, kDone, kCancelled, kReplaced };
+    static const char* state_name(int s) {
+        static const char* const names[] = {"pending", "running", "done", "cancelled", "replaced"};
+        return names[s];
+    }
+
+    uint64_t id = 0;
+    std::vector<TrajectorySample> samples;
+    std::atomic<int> state{kPending};
+    std::atomic<size_t> next{0};
+    // Wake-up lateness of each sample against its scheduled deadline.
+    LatencyStat jitter;
+};
+
+class TrajectoryRunner {
+public:
+    void start(ros::Publisher pub, int rt_priority) {
+        m_pub = pub;
+        m_rt_priority = rt_priority;
+        m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        m_running = true;
+        m_thread = std::thread(&TrajectoryRunner::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            m_running = false;
+        }
+        wake();
+        if (m_thread.joinable()) m_thread.join();
+        if (m_timer_fd >= 0) close(m_timer_fd);
+        if (m_wake_fd >= 0) close(m_wake_fd);
+    }
+
+    // Queues `t` to start now, replacing whatever is running.
+    std::shared_ptr<Trajectory> submit(std::vector<TrajectorySample> samples) {
+        auto t = std::make_shared<Trajectory>();
+        t->samples = std::move(samples);
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            t->id = ++m_last_id;
+            m_pending = t;
+            m_cancel = false;
+            m_active.store(true, std::memory_order_release);
+        }
+        wake();
+        return t;
+    }
+
+    // Stops the running trajectory. With `stop_robot` a zero twist follows;
+    // teleop takeover passes false because its own command is about to go out.
+    bool cancel(bool stop_robot) {
+        if (!m_active.load(std::memory_order_acquire)) return false;
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            m_pending.reset();
+            m_cancel = true;
+            m_cancel_stop = stop_robot;
+        }
+        wake();
+        return true;
+    }
+
+    // The running trajectory, or the last one to finish.
+    std::shared_ptr<Trajectory> current() {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        return m_current;
+    }
+
+private:
+    static int64_t mono_ns() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t r = write(m_wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+
+    void publish(double linear, double angular) {
+        geometry_msgs::Twist msg;
+        msg.linear.x = linear;
+        msg.angular.z = angular;
+        if (m_pub) m_pub.publish(msg);
+    }
+
+    // Blocks until the absolute deadline or a wake-up; false on wake-up.
+    bool sleep_until(int64_t deadline_ns) {
+        itimerspec its = {};
+        its.it_value.tv_sec = deadline_ns / 1000000000LL;
+        its.it_value.tv_nsec = deadline_ns % 1000000000LL;
+        timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+        pollfd fds[2] = {{m_timer_fd, POLLIN, 0}, {m_wake_fd, POLLIN, 0}};
+        while (poll(fds, 2, -1) < 0 && errno == EINTR) {}
+        uint64_t n;
+        if (fds[1].revents & POLLIN) {
+            ssize_t r = read(m_wake_fd, &n, sizeof(n));
+            (void)r;
+            return false;
+        }
+        ssize_t r = read(m_timer_fd, &n, sizeof(n));
+        (void)r;
+        return true;
+    }
+
+    void run() {
+        if (m_rt_priority > 0) {
+            sched_param sp = {};
+            sp.sched_priority = m_rt_priority;
+            int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+            if (err != 0) ROS_WARN("Trajectory thread: SCHED_FIFO %d unavailable (%s)", m_rt_priority, strerror(err));
+        }
+        std::shared_ptr<Trajectory> t;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lk(m_mtx);
+                if (!m_running) break;
+                if (m_pending) {
+                    if (m_current && m_current->state == Trajectory::kRunning)
+                        m_current->state = Trajectory::kReplaced;
+                    t = m_current = std::move(m_pending);
+                    m_pending.reset();
+                } else {
+                    t.reset();
+                }
+            }
+            if (!t) {
+                m_active.store(false, std::memory_order_release);
+                // A submit that raced the check above also set m_active; restore it.
+                {
+                    std::lock_guard<std::mutex> lk(m_mtx);
+                    if (m_pending || !m_running) {
+                        m_active.store(true, std::memory_order_release);
+                        continue;
+                    }
+                }
+                pollfd pfd = {m_wake_fd, POLLIN, 0};
+                while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+                uint64_t n;
+                ssize_t r = read(m_wake_fd, &n, sizeof(n));
+                (void)r;
+                continue;
+            }
+            execute(*t);
+        }
+    }
+
+    void execute(Trajectory& t) {
+        t.state = Trajectory::kRunning;
+        int64_t start = mono_ns();
+        for (size_t i = 0; i < t.samples.size(); ++i) {
+            const TrajectorySample& s = t.samples[i];
+            int64_t deadline = start + static_cast<int64_t>(s.t * 1e9);
+            while (!sleep_until(deadline)) {
+                std::lock_guard<std::mutex> lk(m_mtx);
+                if (m_pending || !m_running) return;  // replaced (or shutting down)
+                if (m_cancel) {
+                    m_cancel = false;
+                    t.state = Trajectory::kCancelled;
+                    if (m_cancel_stop) publish(0, 0);
+                    return;
+                }
+            }
+            int64_t late = mono_ns() - deadline;
+            publish(s.linear, s.angular);
+            t.jitter.record(late > 0 ? late : 0);
+            t.next = i + 1;
+        }
+        publish(0, 0);
+        t.state = Trajectory::kDone;
+    }
+
+    ros::Publisher m_pub;
+    int m_rt_priority = 0;
+    int m_timer_fd = -1, m_wake_fd = -1;
+    std::mutex m_mtx;
+    bool m_running = false, m_cancel = false, m_cancel_stop = true;
+    std::atomic<bool> m_active{false};
+    uint64_t m_last_id = 0;
+    std::shared_ptr<Trajectory> m_pending, m_current;
+    std::thread m_thread;
+};
+
+// ================ Robots ================
+
+enum LidarFormat { kLidarJson, kLidarPacked, kLidarCbor, kLidarMsgpack, kLidarFormats };
+
+// Offered media types, indexed by LidarFormat.
+const char* const g_lidar_types[] = {
+    "application/json", "application/octet-stream", "application/cbor", "application/msgpack",
+    "application/x-msgpack", "application/vnd.msgpack",
+};
+
+const char* const g_lidar_variants[kLidarFormats] = {"", "-f32", "-cbor", "-msgpack"};
+
+// Robot ids become a ROS namespace, a URL path segment and a Prometheus label
+// value, so they are limited to what all three accept unescaped: a letter,
+// then letters, digits and underscores.
+inline bool valid_robot_id(std::string_view id) {
+    if (id.empty() || !std::isalpha((unsigned char)id[0])) return false;
+    for (char ch : id)
+        if (!std::isalnum((unsigned char)ch) && ch != '_') return false;
+    return true;
+}
+
+// One served robot: its status shard, the response bodies built from it and
+// its command publishers. With WHEELTEC_ROBOTS the driver serves one robot
+// per ROS namespace under /robots/{id}/; the first one is also served at the
+// top-level routes, which is all a single-robot driver has.
+struct Robot {
+    Robot(std::string robot_id, std::string robot_ns) : id(std::move(robot_id)), ns(std::move(robot_ns)) {}
+
+    const std::string id;  // path segment under /robots/
+    const std::string ns;  // ROS namespace of its topics; "" for the global one
+    RobotStatus status;
+
+    // Serialized bodies, one per field selection, plus reduced lidar views.
+    VersionedBody status_bodies[kFieldAll + 1];
+    VariantBodies view_bodies;
+    VersionedBody lidar_bodies[kLidarFormats] = {
+        VersionedBody(g_lidar_variants[kLidarJson]), VersionedBody(g_lidar_variants[kLidarPacked]),
+        VersionedBody(g_lidar_variants[kLidarCbor]), VersionedBody(g_lidar_variants[kLidarMsgpack]),
+    };
+    // The latest frame, JPEG-encoded at most once per camera slot version no
+    // matter how many snapshot requests and MJPEG viewers want it.
+    VersionedBody camera_jpeg{"-jpeg"};
+    VersionedBody lidar_summary{"-summary"};
+
+    ros::Publisher nav_pub, move_pub;
+    VelocityCoalescer velocity;
+    TrajectoryRunner trajectory;
+
+    // Requests served for this robot and the thread CPU time they took.
+    std::atomic<uint64_t> requests{0}, request_cpu_ns{0};
+
+    // Teleop command from /move or /ws: takes over from any running trajectory.
+    void teleop(double linear, double angular) {
+        trajectory.cancel(false);
+        velocity.submit(linear, angular);
+    }
+
+    size_t body_bytes() {
+        size_t n = view_bodies.bytes() + camera_jpeg.bytes() + lidar_summary.bytes();
+        for (const auto& b : status_bodies) n += b.bytes();
+        for (const auto& b : lidar_bodies) n += b.bytes();
+        return n;
+    }
+};
+
+// Fixed after startup, so readers need no lock.
+std::vector<std::unique_ptr<Robot>> g_robots;
+
+// The robot served at the top-level routes.
+inline Robot& default_robot() { return *g_robots.front(); }
+
+inline Robot* find_robot(std::string_view id) {
+    for (auto& r : g_robots)
+        if (r->id == id) return r.get();
+    return nullptr;
+}
+
+// `topic` inside the namespace `ns`; "" leaves it unchanged.
+inline std::string robot_topic(const std::string& ns, const std::string& topic) {
+    if (ns.empty()) return topic;
+    return topic.empty() || topic[0] == '/' ? ns + topic : ns + "/" + topic;
+}
+
+// ================ HTTP Request Router ================
+
+std::string build_status_body(const RobotStatus& status, unsigned fields, const ScanView& view = ScanView()) {
+    auto battery = (fields & kFieldBattery) ? status.battery.snapshot() : nullptr;
+    auto camera = (fields & kFieldCamera) ? status.camera.snapshot() : nullptr;
+    auto imu = (fields & kFieldImu) ? status.imu.snapshot() : nullptr;
+    auto lidar = (fields & kFieldLidar) ? status.lidar.snapshot() : nullptr;
+    auto odom = (fields & kFieldOdometry) ? status.odom.snapshot() : nullptr;
+
+    ScanViewData reduced;
+    if (lidar && !view.identity()) make_scan_view(*lidar, view, reduced);
+    const sensor_msgs::LaserScan* scan = lidar ? (view.identity() ? lidar.get() : &reduced.scan) : nullptr;
+
+    // Written with keys in sorted order, as the jsoncpp tree used to print.
+    std::string out;
+    out.reserve(1024 + (scan ? 20 * (scan->ranges.size() + reduced.ranges_mm.size()) : 0));
+    JsonWriter w(out);
+    auto xyz = [&w](const char* name, double x, double y, double z) {
+        w.key(name);
+        w.begin_object();
+        w.key("x"); w.value(x);
+        w.key("y"); w.value(y);
+        w.key("z"); w.value(z);
+        w.end_object();
+    };
+    auto quaternion = [&w](const char* name, const geometry_msgs::Quaternion& q) {
+        w.key(name);
+        w.begin_object();
+        w.key("w"); w.value(q.w);
+        w.key("x"); w.value(q.x);
+        w.key("y"); w.value(q.y);
+        w.key("z"); w.value(q.z);
+        w.end_object();
+    };
+
+    w.begin_object();
+    // Battery
+    if (fields & kFieldBattery) {
+        w.key("battery");
+        if (battery) w.value(static_cast<double>(battery->data));
+        else w.null();
+    }
+    // Camera; for brevity, raw image bytes are not included
+    if (camera) {
+        const auto& c = *camera;
+        w.key("camera");
+        w.begin_object();
+        w.key("data_len"); w.value(static_cast<uint64_t>(c.data.size()));
+        w.key("encoding"); w.value(c.encoding);
+        w.key("height"); w.value(c.height);
+        w.key("stamp"); w.value(c.header.stamp.toSec());
+        w.key("step"); w.value(c.step);
+        w.key("width"); w.value(c.width);
+        w.end_object();
+    }
+    // IMU
+    if (imu) {
+        const auto& i = *imu;
+        w.key("imu");
+        w.begin_object();
+        xyz("angular_velocity", i.angular_velocity.x, i.angular_velocity.y, i.angular_velocity.z);
+        xyz("linear_acceleration", i.linear_acceleration.x, i.linear_acceleration.y, i.linear_acceleration.z);
+        quaternion("orientation", i.orientation);
+        w.key("stamp"); w.value(i.header.stamp.toSec());
+        w.end_object();
+    }
+    // Lidar
+    if (scan) {
+        const auto& l = *scan;
+        w.key("lidar");
+        w.begin_object();
+        w.key("angle_increment"); w.value(static_cast<double>(l.angle_increment));
+        w.key("angle_max"); w.value(static_cast<double>(l.angle_max));
+        w.key("angle_min"); w.value(static_cast<double>(l.angle_min));
+        w.key("range_max"); w.value(static_cast<double>(l.range_max));
+        w.key("range_min"); w.value(static_cast<double>(l.range_min));
+        if (view.mm) {
+            w.key("ranges_mm");
+            w.begin_array();
+            for (uint16_t r : reduced.ranges_mm) w.value(static_cast<uint32_t>(r));
+            w.end_array();
+        } else if (!l.ranges.empty()) {
+            w.key("ranges");
+            w.begin_array();
+            for (float r : l.ranges) w.value(static_cast<double>(r));
+            w.end_array();
+        }
+        w.key("scan_time"); w.value(static_cast<double>(l.scan_time));
+        w.key("stamp"); w.value(l.header.stamp.toSec());
+        w.key("time_increment"); w.value(static_cast<double>(l.time_increment));
+        w.end_object();
+    }
+    // Odometry
+    if (odom) {
+        const auto& o = *odom;
+        w.key("odometry");
+        w.begin_object();
+        xyz("angular", o.twist.twist.angular.x, o.twist.twist.angular.y, o.twist.twist.angular.z);
+        xyz("linear", o.twist.twist.linear.x, o.twist.twist.linear.y, o.twist.twist.linear.z);
+        quaternion("orientation", o.pose.pose.orientation);
+        w.key("stamp"); w.value(o.header.stamp.toSec());
+        w.key("x"); w.value(o.pose.pose.position.x);
+        w.key("y"); w.value(o.pose.pose.position.y);
+        w.key("z"); w.value(o.pose.pose.position.z);
+        w.end_object();
+    }
+    if (w.empty()) return "null\n";
+    w.end_object();
+    out += '\n';
+    return out;
+}
+
+// Lidar view query parameters; see parse_scan_view.
+const char* const kScanViewUsage = "Lidar views: decimate=1..256, bin=stride|min, units=m|mm";
+
+// /status GET; `fields` selects the sections to serialize. Requests that
+// include the lidar section accept the view parameters.
+void handle_status(Connection& conn, const HttpRequest& req, Robot& robot, unsigned fields) {
+    ScanView view;
+    if ((fields & kFieldLidar) && !parse_scan_view(req.query, view)) {
+        http_error(conn, 400, kScanViewUsage);
+        return;
+    }
+    // Slots are published before their versions are bumped, so the body is
+    // at least as new as its tag; if it is newer, the next request rebuilds.
+    const RobotStatus& status = robot.status;
+    uint64_t version = status_version(status, fields);
+    auto build = [&status, fields, view]() { return build_status_body(status, fields, view); };
+    auto cached = view.identity()
+                      ? robot.status_bodies[fields].get(version, build)
+                      : robot.view_bodies.get("-s" + std::to_string(fields) + view.key(), version, build);
+    http_send_cached(conn, req, "application/json", *cached);
+}
+
+// /nav POST: expects JSON body with fields: "points" (array of [x,y]), "algorithm" ("dijkstra" or "astar")
+void handle_nav(Connection& conn, Robot& robot, std::string_view body) {
+    Json::Value req;
+    Json::Reader jr;
+    if (!jr.parse(body.data(), body.data() + body.size(), req)) {
+        http_error(conn, 400, "Invalid JSON");
+        return;
+    }
+    if (!req.isMember("points") || !req["points"].isArray()) {
+        http_error(conn, 400, "Missing 'points' array");
+        return;
+    }
+    std::string algorithm = req.get("algorithm", "dijkstra").asString();
+
+    std_msgs::String msg;
+    Json::FastWriter fw;
+    msg.data = fw.write(req);
+    if (robot.nav_pub) robot.nav_pub.publish(msg);
+
+    Json::Value resp;
+    resp["status"] = "ok";
+    resp["algorithm"] = algorithm;
+    http_send_json(conn, resp);
+}
+
+// /move POST: expects JSON body with "linear" (float), "angular" (float)
+void handle_move(Connection& conn, Robot& robot, std::string_view body) {
+    Json::Value req;
+    Json::Reader jr;
+    if (!jr.parse(body.data(), body.data() + body.size(), req)) {
+        http_error(conn, 400, "Invalid JSON");
+        return;
+    }
+    if (!req.isObject() || !req.isMember("linear") || !req.isMember("angular")) {
+        http_error(conn, 400, "Missing 'linear' or 'angular'");
+        return;
+    }
+    if (!req["linear"].isNumeric() || !req["angular"].isNumeric()) {
+        http_error(conn, 400, "'linear' and 'angular' must be numeric");
+        return;
+    }
+    double linear = req["linear"].asDouble();
+    double angular = req["angular"].asDouble();
+    robot.teleop(linear, angular);
+
+    Json::Value resp;
+    resp["status"] = "ok";
+    resp["linear"] = linear;
+    resp["angular"] = angular;
+    http_send_json(conn, resp);
+}
+
+const size_t kMaxTrajectorySamples = 10000;
+const double kMaxTrajectorySeconds = 3600;
+
+// /trajectory POST: a JSON array of {"t": <s from start>, "linear", "angular"}
+// (or {"samples": [...]}) with non-decreasing t. Replaces any running
+// trajectory and pauses teleop republishing until the next /move.
+void handle_trajectory_post(Connection& conn, Robot& robot, std::string_view body) {
+    Json::Value req;
+    Json::Reader jr;
+    if (!jr.parse(body.data(), body.data() + body.size(), req)) {
+        http_error(conn, 400, "Invalid JSON");
+        return;
+    }
+    const Json::Value& list = req.isObject() ? req["samples"] : req;
+    if (!list.isArray() || list.empty() || list.size() > kMaxTrajectorySamples) {
+        http_error(conn, 400, "Expected 1.." + std::to_string(kMaxTrajectorySamples) + " samples");
+        return;
+    }
+    std::vector<TrajectorySample> samples;
+    samples.reserve(list.size());
+    double prev = 0;
+    for (const Json::Value& s : list) {
+        if (!s.isObject() || !s["t"].isNumeric() || !s["linear"].isNumeric() || !s["angular"].isNumeric()) {
+            http_error(conn, 400, "Each sample needs numeric 't', 'linear' and 'angular'");
+            return;
+        }
+        double t = s["t"].asDouble();
+        if (!(t >= prev && t <= kMaxTrajectorySeconds)) {
+            http_error(conn, 400, "Sample times must be non-decreasing, from 0 to 3600 s");
+            return;
+        }
+        prev = t;
+        samples.push_back({t, s["linear"].asDouble(), s["angular"].asDouble()});
+    }
+    robot.velocity.release();
+    auto t = robot.trajectory.submit(std::move(samples));
+
+    Json::Value resp;
+    resp["status"] = "ok";
+    resp["id"] = (Json::UInt64)t->id;
+    resp["samples"] = (Json::UInt64)t->samples.size();
+    resp["duration"] = prev;
+    http_send_json(conn, resp);
+}
+
+// /trajectory GET: progress and publish jitter of the current (or last) one
+void handle_trajectory_get(Connection& conn, Robot& robot) {
+    Json::Value resp;
+    auto t = robot.trajectory.current();
+    if (t) {
+        resp["id"] = (Json::UInt64)t->id;
+        resp["state"] = Trajectory::state_name(t->state);
+        resp["samples"] = (Json::UInt64)t->samples.size();
+        resp["published"] = (Json::UInt64)t->next.load();
+        resp["jitter"] = t->jitter.to_json();
+    } else {
+        resp["state"] = "none";
+    }
+    http_send_json(conn, resp);
+}
+
+// /trajectory DELETE: stop the running trajectory and the robot
+void handle_trajectory_delete(Connection& conn, Robot& robot) {
+    Json::Value resp;
+    resp["status"] = "ok";
+    resp["cancelled"] = robot.trajectory.cancel(true);
+    http_send_json(conn, resp);
+}
+
+// ================ Lidar Encodings ================
+
+// Appends big-endian (CBOR, MessagePack) or little-endian (packed frame)
+// scalars to a body under construction.
+struct ByteWriter {
+    std::string& out;
+
+    void u8(uint8_t v) { out.push_back(static_cast<char>(v)); }
+    void be16(uint16_t v) { u8(v >> 8); u8(v); }
+    void be32(uint32_t v) { be16(v >> 16); be16(v); }
+    void be64(uint64_t v) { be32(v >> 32); be32(v); }
+    void bef32(float f) { uint32_t v; std::memcpy(&v, &f, 4); be32(v); }
+    void bef64(double d) { uint64_t v; std::memcpy(&v, &d, 8); be64(v); }
+    void le32(uint32_t v) { u8(v); u8(v >> 8); u8(v >> 16); u8(v >> 24); }
+    void lef32(float f) { uint32_t v; std::memcpy(&v, &f, 4); le32(v); }
+    void lef64(double d) {
+        uint64_t v;
+        std::memcpy(&v, &d, 8);
+        le32(static_cast<uint32_t>(v));
+        le32(static_cast<uint32_t>(v >> 32));
+    }
+    void raw(const void* p, size_t n) { out.append(static_cast<const char*>(p), n); }
+};
+
+// Packed frame ("application/octet-stream"), all fields little-endian:
+//   0  char[4]  magic "WLS1"
+//   4  uint32   number of ranges N
+//   8  float64  header.stamp in seconds
+//   16 float32  angle_min, angle_max, angle_increment, time_increment,
+//               scan_time, range_min, range_max
+//   44 float32  ranges[N]
+// With units=mm the magic is "WLQ1" and ranges are uint16 millimetres.
+std::string encode_scan_packed(const sensor_msgs::LaserScan& l, const std::vector<uint16_t>* mm = nullptr) {
+    size_t n = mm ? mm->size() : l.ranges.size();
+    std::string out;
+    out.reserve(44 + 4 * n);
+    ByteWriter w{out};
+    w.raw(mm ? "WLQ1" : "WLS1", 4);
+    w.le32(static_cast<uint32_t>(n));
+    w.lef64(l.header.stamp.toSec());
+    for (float f : {l.angle_min, l.angle_max, l.angle_increment, l.time_increment, l.scan_time, l.range_min, l.range_max})
+        w.lef32(f);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (mm) w.raw(mm->data(), 2 * n);
+    else w.raw(l.ranges.data(), 4 * n);
+#else
+    if (mm) for (uint16_t r : *mm) { w.u8(r); w.u8(r >> 8); }
+    else for (float r : l.ranges) w.lef32(r);
+#endif
+    return out;
+}
+
+// CBOR (RFC 8949) map with the same keys as the JSON form plus "stamp";
+// floats are encoded as single precision, the stamp as double. With units=mm
+// "ranges" is replaced by "ranges_mm", an array of unsigned integers.
+std::string encode_scan_cbor(const sensor_msgs::LaserScan& l, const std::vector<uint16_t>* mm = nullptr) {
+    std::string out;
+    out.reserve(96 + 5 * l.ranges.size());
+    ByteWriter w{out};
+    auto head = [&w](uint8_t major, uint64_t n) {
+        if (n < 24) w.u8((major << 5) | n);
+        else if (n <= 0xff) { w.u8((major << 5) | 24); w.u8(n); }
+        else if (n <= 0xffff) { w.u8((major << 5) | 25); w.be16(n); }
+        else { w.u8((major << 5) | 26); w.be32(static_cast<uint32_t>(n)); }
+    };
+    auto key = [&w, &head](const char* k) {
+        size_t n = std::strlen(k);
+        head(3, n);
+        w.raw(k, n);
+    };
+    auto f32 = [&w](float f) { w.u8(0xfa); w.bef32(f); };
+    head(5, 9);
+    key("stamp");
+    w.u8(0xfb);
+    w.bef64(l.header.stamp.toSec());
+    key("angle_min"); f32(l.angle_min);
+    key("angle_max"); f32(l.angle_max);
+    key("angle_increment"); f32(l.angle_increment);
+    key("time_increment"); f32(l.time_increment);
+    key("scan_time"); f32(l.scan_time);
+    key("range_min"); f32(l.range_min);
+    key("range_max"); f32(l.range_max);
+    if (mm) {
+        key("ranges_mm");
+        head(4, mm->size());
+        for (uint16_t r : *mm) head(0, r);
+    } else {
+        key("ranges");
+        head(4, l.ranges.size());
+        for (float r : l.ranges) f32(r);
+    }
+    return out;
+}
+
+// MessagePack map, same layout as the CBOR form.
+std::string encode_scan_msgpack(const sensor_msgs::LaserScan& l, const std::vector<uint16_t>* mm = nullptr) {
+    std::string out;
+    out.reserve(96 + 5 * l.ranges.size());
+    ByteWriter w{out};
+    auto key = [&w](const char* k) {
+        size_t n = std::strlen(k);
+        w.u8(0xa0 | n);  // fixstr, all keys are shorter than 32 bytes
+        w.raw(k, n);
+    };
+    auto f32 = [&w](float f) { w.u8(0xca); w.bef32(f); };
+    w.u8(0x80 | 9);
+    key("stamp");
+    w.u8(0xcb);
+    w.bef64(l.header.stamp.toSec());
+    key("angle_min"); f32(l.angle_min);
+    key("angle_max"); f32(l.angle_max);
+    key("angle_increment"); f32(l.angle_increment);
+    key("time_increment"); f32(l.time_increment);
+    key("scan_time"); f32(l.scan_time);
+    key("range_min"); f32(l.range_min);
+    key("range_max"); f32(l.range_max);
+    key(mm ? "ranges_mm" : "ranges");
+    size_t n = mm ? mm->size() : l.ranges.size();
+    if (n < 16) w.u8(0x90 | n);
+    else if (n <= 0xffff) { w.u8(0xdc); w.be16(n); }
+    else { w.u8(0xdd); w.be32(static_cast<uint32_t>(n)); }
+    if (mm) {
+        for (uint16_t r : *mm) {
+            if (r < 0x80) w.u8(r);  // positive fixint
+            else { w.u8(0xcd); w.be16(r); }
+        }
+    } else {
+        for (float r : l.ranges) f32(r);
+    }
+    return out;
+}
 
-// ================ Utility Functions ================
+// /lidar GET: the latest scan in the representation the Accept header asks
+// for, optionally reduced with the view parameters (decimate, bin, units).
+void handle_lidar(Connection& conn, const HttpRequest& req, Robot& robot) {
+    int choice = negotiate_accept(req.header("Accept"), g_lidar_types, 6);
+    if (choice < 0) {
+        http_error(conn, 406, "Supported: application/json, application/octet-stream, application/cbor, application/msgpack");
+        return;
+    }
+    ScanView view;
+    if (!parse_scan_view(req.query, view)) {
+        http_error(conn, 400, kScanViewUsage);
+        return;
+    }
+    LidarFormat fmt = static_cast<LidarFormat>(std::min(choice, (int)kLidarMsgpack));
+    const RobotStatus& status = robot.status;
+    if (fmt == kLidarJson) {
+        auto build = [&status, view]() { return build_status_body(status, kFieldLidar, view); };
+        uint64_t version = status_version(status, kFieldLidar);
+        auto cached = view.identity()
+                          ? robot.status_bodies[kFieldLidar].get(version, build)
+                          : robot.view_bodies.get("-s" + std::to_string(kFieldLidar) + view.key(), version, build);
+        http_send_cached(conn, req, "application/json", *cached, "Vary: Accept\r\n");
+        return;
+    }
+    // Read the version before the scan so the body is never older than its tag.
+    uint64_t version = status.lidar.version();
+    if (version == 0) {
+        http_error(conn, 503, "No scan received yet");
+        return;
+    }
+    auto build = [&status, fmt, view]() {
+        auto scan = status.lidar.snapshot();
+        ScanViewData reduced;
+        if (!view.identity()) make_scan_view(*scan, view, reduced);
+        const sensor_msgs::LaserScan& l = view.identity() ? *scan : reduced.scan;
+        const std::vector<uint16_t>* mm = view.mm ? &reduced.ranges_mm : nullptr;
+        if (fmt == kLidarPacked) return encode_scan_packed(l, mm);
+        if (fmt == kLidarCbor) return encode_scan_cbor(l, mm);
+        return encode_scan_msgpack(l, mm);
+    };
+    auto cached = view.identity() ? robot.lidar_bodies[fmt].get(version, build)
+                                  : robot.view_bodies.get(g_lidar_variants[fmt] + view.key(), version, build);
+    http_send_cached(conn, req, g_lidar_types[choice], *cached, "Vary: Accept\r\n");
+}
 
-inline std::string getenv_default(const char* key, const char* dflt) {
-    const char* v = std::getenv(key);
-    if (v == nullptr) return std::string(dflt);
-    return std::string(v);
+// /lidar/summary GET: LidarSummary of the latest scan, for clients that poll
+// for obstacles and do not want the ranges. NaN ranges are written as null.
+void handle_lidar_summary(Connection& conn, const HttpRequest& req, Robot& robot) {
+    const RobotStatus& status = robot.status;
+    uint64_t version = status.lidar_summary.version();
+    if (version == 0) {
+        http_error(conn, 503, "No scan received yet");
+        return;
+    }
+    auto cached = robot.lidar_summary.get(version, [&status]() {
+        auto s = status.lidar_summary.snapshot();
+        std::string out;
+        out.reserve(160 + 24 * s->sectors.size());
+        JsonWriter w(out);
+        w.begin_object();
+        w.key("angle_min"); w.value(static_cast<double>(s->angle_min));
+        w.key("beams"); w.value(s->beams);
+        w.key("nearest"); w.value(static_cast<double>(s->nearest));
+        w.key("nearest_angle"); w.value(static_cast<double>(s->nearest_angle));
+        w.key("sector_width"); w.value(static_cast<double>(s->sector_width));
+        w.key("sectors");
+        w.begin_array();
+        for (float m : s->sectors) w.value(static_cast<double>(m));
+        w.end_array();
+        w.key("stamp"); w.value(s->stamp.toSec());
+        w.key("valid"); w.value(s->valid);
+        w.end_object();
+        out += '\n';
+        return out;
+    });
+    http_send_cached(conn, req, "application/json", *cached);
 }
 
-inline int getenv_int(const char* key, int dflt) {
-    const char* v = std::getenv(key);
-    if (v == nullptr) return dflt;
-    return std::atoi(v);
+// ================ History Endpoint ================
+
+// Columnar JSON: {"topic":..., "count":N, "stamp":[...], "<column>":[...], ...},
+// numbers spelled as in /status.
+template <typename T, size_t N>
+std::string history_json(const char* topic, const std::vector<T>& samples, const HistoryColumn (&cols)[N]) {
+    std::string out;
+    out.reserve(64 + samples.size() * (N + 1) * 24);
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("topic"); w.value(topic);
+    w.key("count"); w.value(static_cast<uint64_t>(samples.size()));
+    w.key("stamp");
+    w.begin_array();
+    for (const T& s : samples) w.value(s.stamp);
+    w.end_array();
+    for (const HistoryColumn& c : cols) {
+        w.key(c.name);
+        w.begin_array();
+        for (const T& s : samples) {
+            float v;
+            std::memcpy(&v, reinterpret_cast<const char*>(&s) + c.offset, sizeof(v));
+            w.value(static_cast<double>(v));
+        }
+        w.end_array();
+    }
+    w.end_object();
+    out += '\n';
+    return out;
 }
 
-inline void http_send(int client_sock, const std::string& header, const std::string& body) {
-    std::string resp = header + std::to_string(body.size()) + "\r\n\r\n" + body;
-    send(client_sock, resp.c_str(), resp.size(), 0);
+// Binary: "WHS1", uint32 count, uint32 record size, then the sample structs
+// (little-endian). X-History-Layout names each field as name:type@offset.
+template <typename T, size_t N>
+void send_history_binary(Connection& conn, const std::vector<T>& samples, const HistoryColumn (&cols)[N]) {
+    std::string layout = "stamp:f64@0";
+    for (const HistoryColumn& c : cols) layout += std::string(",") + c.name + ":f32@" + std::to_string(c.offset);
+    std::string body;
+    body.reserve(12 + samples.size() * sizeof(T));
+    ByteWriter w{body};
+    w.raw("WHS1", 4);
+    w.le32(static_cast<uint32_t>(samples.size()));
+    w.le32(sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w.raw(samples.data(), samples.size() * sizeof(T));
+#else
+    for (const T& s : samples) {
+        w.lef64(s.stamp);
+        for (size_t off = 8; off < sizeof(T); off += 4) {
+            float v;
+            std::memcpy(&v, reinterpret_cast<const char*>(&s) + off, sizeof(v));
+            w.lef32(v);
+        }
+    }
+#endif
+    std::string header = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nVary: Accept\r\n"
+                         "X-History-Layout: " + layout + "\r\nContent-Length: ";
+    http_send(conn, header, std::move(body));
 }
 
-inline void http_send_json(int client_sock, const Json::Value& val) {
-    Json::FastWriter fw;
-    std::string out = fw.write(val);
-    std::string header = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: ";
-    http_send(client_sock, header, out);
+template <typename T, size_t N>
+void send_history(Connection& conn, const char* topic, const HistoryRing<T>& ring, const HistoryColumn (&cols)[N],
+                  double since, size_t max, bool binary) {
+    std::vector<T> samples;
+    max = std::min(max, ring.capacity());
+    samples.reserve(max);
+    ring.read(since, max, samples);
+    if (binary) {
+        send_history_binary(conn, samples, cols);
+        return;
+    }
+    std::string header = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nVary: Accept\r\nContent-Length: ";
+    http_send(conn, header, history_json(topic, samples, cols));
 }
 
-inline void http_error(int client_sock, int code, const std::string& msg) {
-    std::ostringstream oss;
-    oss << "HTTP/1.1 " << code << " ERROR\r\nContent-Type: text/plain\r\nContent-Length: " << msg.size() << "\r\n\r\n" << msg;
-    send(client_sock, oss.str().c_str(), oss.str().size(), 0);
+const char* const g_history_types[] = {"application/json", "application/octet-stream"};
+
+// /history GET: recent samples of one topic, read without blocking the
+// callbacks. Query: topic=battery|odom|imu, since=<stamp in s> (samples
+// after it, oldest first), max=N (default 1000). Without since, the newest
+// max samples. Accept: application/json (columnar) or application/octet-stream.
+void handle_history(Connection& conn, const HttpRequest& req, Robot& robot) {
+    int choice = negotiate_accept(req.header("Accept"), g_history_types, 2);
+    if (choice < 0) {
+        http_error(conn, 406, "Supported: application/json, application/octet-stream");
+        return;
+    }
+    double since = -1;
+    std::string_view s = query_param(req.query, "since");
+    if (!s.empty()) {
+        std::string str(s);
+        char* end = nullptr;
+        since = std::strtod(str.c_str(), &end);
+        if (*end != '\0' || !(since >= 0)) {
+            http_error(conn, 400, "'since' must be a non-negative stamp in seconds");
+            return;
+        }
+    }
+    size_t max = 1000;
+    std::string_view m = query_param(req.query, "max");
+    if (!m.empty()) {
+        int n = std::atoi(std::string(m).c_str());
+        if (n < 1) {
+            http_error(conn, 400, "'max' must be a positive integer");
+            return;
+        }
+        max = n;
+    }
+    bool binary = choice == 1;
+    std::string_view topic = query_param(req.query, "topic");
+    const SensorHistory& h = robot.status.history;
+    if (topic == "battery") send_history(conn, "battery", h.battery, g_battery_columns, since, max, binary);
+    else if (topic == "odom") send_history(conn, "odom", h.odom, g_odom_columns, since, max, binary);
+    else if (topic == "imu") send_history(conn, "imu", h.imu, g_imu_columns, since, max, binary);
+    else http_error(conn, 400, "'topic' must be battery, odom or imu");
 }
 
-// ================ ROS Data Handlers ================
+// ================ Camera Frames ================
 
-struct RobotStatus {
-    float battery = 0.0f;
-    nav_msgs::Odometry odom;
-    sensor_msgs::Imu imu;
-    sensor_msgs::LaserScan lidar;
-    sensor_msgs::Image camera;
-    std::mutex mtx;
-    bool odom_ready = false, imu_ready = false, lidar_ready = false, camera_ready = false, battery_ready = false;
+struct JpegErrorMgr {
+    jpeg_error_mgr base;
+    jmp_buf jump;
 };
 
-RobotStatus g_status;
+// libjpeg's default error handler exits the process; unwind to the caller instead.
+extern "C" void jpeg_error_longjmp(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<JpegErrorMgr*>(cinfo->err)->jump, 1);
+}
+
+// JPEG-encodes a raw image. Returns an empty string for encodings we cannot
+// map to a libjpeg colour space (or a malformed image).
+std::string encode_jpeg(const sensor_msgs::Image& img, int quality) {
+    J_COLOR_SPACE space;
+    int components;
+    if (img.encoding == "rgb8") { space = JCS_RGB; components = 3; }
+    else if (img.encoding == "bgr8") { space = JCS_EXT_BGR; components = 3; }
+    else if (img.encoding == "rgba8") { space = JCS_EXT_RGBA; components = 4; }
+    else if (img.encoding == "bgra8") { space = JCS_EXT_BGRA; components = 4; }
+    else if (img.encoding == "mono8") { space = JCS_GRAYSCALE; components = 1; }
+    else return std::string();
+    if (img.width == 0 || img.height == 0 || img.step < img.width * components ||
+        img.data.size() < (size_t)img.step * img.height)
+        return std::string();
 
-void battery_cb(const std_msgs::Float32::ConstPtr& msg) {
-    std::lock_guard<std::mutex> lk(g_status.mtx);
-    g_status.battery = msg->data;
-    g_status.battery_ready = true;
+    jpeg_compress_struct cinfo;
+    JpegErrorMgr err;
+    unsigned char* buf = nullptr;
+    unsigned long len = 0;
+    cinfo.err = jpeg_std_error(&err.base);
+    err.base.error_exit = jpeg_error_longjmp;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buf);
+        return std::string();
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &len);
+    cinfo.image_width = img.width;
+    cinfo.image_height = img.height;
+    cinfo.input_components = components;
+    cinfo.in_color_space = space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = const_cast<JSAMPROW>(&img.data[(size_t)cinfo.next_scanline * img.step]);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    std::string out(reinterpret_cast<const char*>(buf), len);
+    free(buf);
+    return out;
 }
-void odom_cb(const nav_msgs::Odometry::ConstPtr& msg) {
-    std::lock_guard<std::mutex> lk(g_status.mtx);
-    g_status.odom = *msg;
-    g_status.odom_ready = true;
+
+int g_jpeg_quality = 80;
+
+inline std::shared_ptr<const CachedBody> cached_jpeg(Robot& robot) {
+    const RobotStatus& status = robot.status;
+    return robot.camera_jpeg.get(status.camera.version(), [&status]() {
+        auto img = status.camera.snapshot();
+        return img ? encode_jpeg(*img, g_jpeg_quality) : std::string();
+    });
 }
-void imu_cb(const sensor_msgs::Imu::ConstPtr& msg) {
-    std::lock_guard<std::mutex> lk(g_status.mtx);
-    g_status.imu = *msg;
-    g_status.imu_ready = true;
+
+inline std::shared_ptr<const std::string> mjpeg_part(const std::string& jpeg) {
+    std::string part = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpeg.size()) + "\r\n\r\n";
+    part.reserve(part.size() + jpeg.size() + 2);
+    part.append(jpeg).append("\r\n");
+    return std::make_shared<const std::string>(std::move(part));
 }
-void lidar_cb(const sensor_msgs::LaserScan::ConstPtr& msg) {
-    std::lock_guard<std::mutex> lk(g_status.mtx);
-    g_status.lidar = *msg;
-    g_status.lidar_ready = true;
+
+// Called from camera_cb: encodes only if someone is watching.
+void publish_camera_frame() {
+    if (!g_streams.has_subscribers(kTopicCamera)) return;
+    auto jpeg = cached_jpeg(default_robot());
+    if (jpeg->body->empty()) return;
+    g_streams.publish_framed(kTopicCamera, StreamFraming::Mjpeg, mjpeg_part(*jpeg->body));
 }
-void camera_cb(const sensor_msgs::Image::ConstPtr& msg) {
-    std::lock_guard<std::mutex> lk(g_status.mtx);
-    g_status.camera = *msg;
-    g_status.camera_ready = true;
+
+// /camera/frame.jpg GET: the latest frame as a JPEG
+void handle_camera_frame(Connection& conn, const HttpRequest& req, Robot& robot) {
+    if (robot.status.camera.version() == 0) {
+        http_error(conn, 503, "No camera frame received yet");
+        return;
+    }
+    auto jpeg = cached_jpeg(robot);
+    if (jpeg->body->empty()) {
+        http_error(conn, 415, "Unsupported image encoding");
+        return;
+    }
+    http_send_cached(conn, req, "image/jpeg", *jpeg);
 }
 
-// ================ HTTP Server ================
+// /camera/stream.mjpg GET: multipart/x-mixed-replace MJPEG stream.
+// Query: fps=<max frames per second>. Slow viewers skip frames.
+void handle_camera_stream(Connection& conn, const HttpRequest& req) {
+    if (g_streams.full()) {
+        http_error(conn, 503, "Too many stream subscribers");
+        return;
+    }
+    auto c = std::make_shared<StreamClient>();
+    c->framing = StreamFraming::Mjpeg;
+    c->topics = 1u << kTopicCamera;
+    std::string_view fps = query_param(req.query, "fps");
+    if (!fps.empty()) {
+        double hz = std::atof(std::string(fps).c_str());
+        if (hz > 0) c->min_interval_ms = static_cast<int64_t>(1000.0 / hz);
+    }
+    if (default_robot().status.camera.version() > 0) {
+        auto jpeg = cached_jpeg(default_robot());
+        if (!jpeg->body->empty()) c->pending[kTopicCamera] = mjpeg_part(*jpeg->body);
+    }
+    static const auto header = std::make_shared<const std::string>(
+        "HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+        "Cache-Control: no-cache\r\nConnection: close\r\n\r\n");
+    c->out = header;
+    conn.on_detach = [c](int fd) {
+        c->fd = fd;
+        g_streams.add(c);
+    };
+}
 
-class HttpServer {
-public:
-    HttpServer(const std::string& host, int port)
-        : m_host(host), m_port(port), m_running(false) {}
+// ================ Stream Endpoints ================
 
-    void start(std::function<void(int)> client_handler) {
-        m_running = true;
-        m_thread = std::thread([this, client_handler]() {
-            run(client_handler);
-        });
+// Streams carry the robot at the top-level routes.
+inline std::shared_ptr<const CachedBody> cached_section(unsigned field) {
+    Robot& robot = default_robot();
+    const RobotStatus& status = robot.status;
+    return robot.status_bodies[field].get(status_version(status, field),
+                                          [&status, field]() { return build_status_body(status, field); });
+}
+
+void publish_camera_frame();
+
+inline StreamTopic topic_of_field(unsigned field) {
+    switch (field) {
+    case kFieldBattery: return kTopicBattery;
+    case kFieldOdometry: return kTopicOdom;
+    case kFieldImu: return kTopicImu;
+    default: return kTopicLidar;
     }
+}
 
-    void stop() {
-        m_running = false;
-        if (m_sock != -1) close(m_sock);
-        if (m_thread.joinable()) m_thread.join();
+// Called from the subscriber callbacks. The event body is the cached
+// /status/<section> document, so pollers and streams share one serialization.
+void notify_status_update(const RobotStatus& robot, unsigned field) {
+    if (!robot.streamed) return;
+    if (field == kFieldCamera) {
+        publish_camera_frame();
+        return;
     }
+    StreamTopic t = topic_of_field(field);
+    if (!g_streams.has_subscribers(t)) return;
+    g_streams.publish(t, *cached_section(field)->body);
+}
 
-    ~HttpServer() { stop(); }
+// Subscription from the query string: topics=odom,imu,battery,lidar (default:
+// battery,odom,imu) and rate=<max events per second per topic>. Queues the
+// current value of every topic so subscribers start with a full picture.
+// Returns false on an unknown topic.
+bool parse_subscription(const HttpRequest& req, StreamClient& c) {
+    std::string_view list = query_param(req.query, "topics");
+    if (list.empty()) list = "battery,odom,imu";
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        int t = stream_topic(list.substr(0, comma));
+        if (t < 0) return false;
+        c.topics |= 1u << t;
+        if (comma == std::string_view::npos) break;
+        list.remove_prefix(comma + 1);
+    }
+    std::string_view rate = query_param(req.query, "rate");
+    if (!rate.empty()) {
+        double hz = std::atof(std::string(rate).c_str());
+        if (hz > 0) c.min_interval_ms = static_cast<int64_t>(1000.0 / hz);
+    }
+    const unsigned fields[kTopicCount] = {kFieldBattery, kFieldOdometry, kFieldImu, kFieldLidar};
+    for (int t = 0; t < kTopicCount; ++t)
+        if ((c.topics & (1u << t)) && status_version(default_robot().status, fields[t]) > 0)
+            c.pending[t] = StreamHub::frame(c.framing, static_cast<StreamTopic>(t), *cached_section(fields[t])->body);
+    return true;
+}
 
-private:
-    std::string m_host;
-    int m_port;
-    std::atomic<bool> m_running;
-    std::thread m_thread;
-    int m_sock = -1;
+// /stream GET: Server-Sent Events, see parse_subscription for the query
+void handle_stream(Connection& conn, const HttpRequest& req) {
+    auto c = std::make_shared<StreamClient>();
+    if (!parse_subscription(req, *c)) {
+        http_error(conn, 400, "Unknown topic in 'topics'");
+        return;
+    }
+    if (g_streams.full()) {
+        http_error(conn, 503, "Too many stream subscribers");
+        return;
+    }
+    // The hub writes the header itself, ahead of the first event.
+    static const auto header = std::make_shared<const std::string>(
+        "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\nX-Accel-Buffering: no\r\n\r\n");
+    c->out = header;
+    conn.on_detach = [c](int fd) {
+        c->fd = fd;
+        g_streams.add(c);
+    };
+}
 
-    void run(std::function<void(int)> client_handler) {
-        m_sock = socket(AF_INET, SOCK_STREAM, 0);
-        int opt = 1;
-        setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// ================ WebSocket Endpoint ================
 
-        sockaddr_in addr;
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(m_port);
-        if (bind(m_sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-            perror("bind failed");
-            exit(1);
+#define WS_MAX_PAYLOAD 65536
+
+// Sends a close frame and ends the session. The hub writes the frame after
+// whatever it has already started, then shuts the socket down; the reactor
+// closes the connection when it sees EOF. Input after this is discarded.
+ConnAction ws_close(Connection& conn, const std::shared_ptr<StreamClient>& c, uint16_t code) {
+    char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code)};
+    g_streams.close_after(c, ws_frame(kWsClose, payload, 2));
+    conn.in.consume(conn.in.size());
+    return ConnAction::KeepOpen;
+}
+
+// Text messages: {"linear": <m/s>, "angular": <rad/s>, "seq": <optional int>}.
+// Binary messages: float32 linear, float32 angular, optional uint32 seq, all
+// little-endian. Commands carrying a seq are acknowledged with the same seq
+// (text {"type":"ack","seq":N} or a 4-byte binary frame) for RTT measurement.
+void ws_command(const std::shared_ptr<StreamClient>& c, int opcode, const char* p, size_t len) {
+    if (opcode == kWsBinary) {
+        if (len != 8 && len != 12) return;
+        float lin, ang;
+        std::memcpy(&lin, p, 4);
+        std::memcpy(&ang, p + 4, 4);
+        if (!std::isfinite(lin) || !std::isfinite(ang)) {
+            static const char error[] = "{\"type\":\"error\",\"message\":\"linear and angular must be finite\"}";
+            g_streams.send_control(c, ws_frame(kWsText, error, sizeof(error) - 1));
+            return;
         }
-        if (listen(m_sock, 16) < 0) {
-            perror("listen failed");
-            exit(1);
+        default_robot().teleop(lin, ang);
+        if (len == 12) g_streams.send_control(c, ws_frame(kWsBinary, p + 8, 4));
+        return;
+    }
+    Json::Value req;
+    Json::Reader jr;
+    std::string reply;
+    if (!jr.parse(p, p + len, req) || !req.isObject() || !req["linear"].isNumeric() || !req["angular"].isNumeric()) {
+        reply = "{\"type\":\"error\",\"message\":\"expected numeric {linear, angular}\"}";
+    } else if (req.isMember("seq") && !req["seq"].isInt64()) {
+        reply = "{\"type\":\"error\",\"message\":\"seq must be an integer\"}";
+    } else {
+        default_robot().teleop(req["linear"].asDouble(), req["angular"].asDouble());
+        if (req.isMember("seq")) reply = "{\"type\":\"ack\",\"seq\":" + std::to_string(req["seq"].asInt64()) + "}";
+    }
+    if (!reply.empty()) g_streams.send_control(c, ws_frame(kWsText, reply.data(), reply.size()));
+}
+
+// Upgrade handler: consumes every complete client frame in the buffer.
+ConnAction ws_on_data(Connection& conn, const std::shared_ptr<StreamClient>& c) {
+    if (g_streams.closing(c)) {
+        conn.in.consume(conn.in.size());
+        return ConnAction::KeepOpen;
+    }
+    while (conn.in.size() >= 2) {
+        uint8_t* p = reinterpret_cast<uint8_t*>(conn.in.mutable_begin());
+        size_t avail = conn.in.size();
+        bool fin = p[0] & 0x80;
+        int opcode = p[0] & 0x0f;
+        uint64_t len = p[1] & 0x7f;
+        size_t hdr = 2;
+        if (len == 126) {
+            if (avail < 4) break;
+            len = (uint64_t)p[2] << 8 | p[3];
+            hdr = 4;
+        } else if (len == 127) {
+            if (avail < 10) break;
+            len = 0;
+            for (int i = 0; i < 8; ++i) len = len << 8 | p[2 + i];
+            hdr = 10;
         }
-        while (m_running) {
-            sockaddr_in c_addr;
-            socklen_t clen = sizeof(c_addr);
-            int client = accept(m_sock, (sockaddr*)&c_addr, &clen);
-            if (client < 0) continue;
-            std::thread([client, client_handler]() {
-                client_handler(client);
-                close(client);
-            }).detach();
+        if (!(p[1] & 0x80) || (p[0] & 0x70)) return ws_close(conn, c, 1002);  // unmasked or reserved bits
+        if (len > WS_MAX_PAYLOAD) return ws_close(conn, c, 1009);
+        if (!fin || opcode == 0) return ws_close(conn, c, 1003);  // fragmented messages are not supported
+        if (avail < hdr + 4 + len) break;
+
+        const uint8_t* mask = p + hdr;
+        char* payload = reinterpret_cast<char*>(p + hdr + 4);
+        for (size_t i = 0; i < len; ++i) payload[i] ^= mask[i & 3];
+
+        switch (opcode) {
+        case kWsText:
+        case kWsBinary:
+            ws_command(c, opcode, payload, len);
+            break;
+        case kWsPing:
+            g_streams.send_control(c, ws_frame(kWsPong, payload, std::min<size_t>(len, 125)));
+            break;
+        case kWsPong:
+            break;
+        case kWsClose:
+            return ws_close(conn, c, 1000);
+        default:
+            return ws_close(conn, c, 1002);
         }
+        conn.in.consume(hdr + 4 + len);
     }
-};
+    return ConnAction::KeepOpen;
+}
 
-// ================ HTTP Request Router ================
+// /ws GET: WebSocket carrying teleop commands from the client and telemetry
+// events ({"topic": ..., "data": ...}) to it; see parse_subscription.
+void handle_ws(Connection& conn, const HttpRequest& req) {
+    std::string_view key = req.header("Sec-WebSocket-Key");
+    if (!iequals(req.header("Upgrade"), "websocket") || !header_has_token(req.header("Connection"), "upgrade") ||
+        key.empty()) {
+        http_error(conn, 400, "Expected a WebSocket upgrade");
+        return;
+    }
+    if (req.header("Sec-WebSocket-Version") != "13") {
+        http_error(conn, 426, "Unsupported WebSocket version");
+        return;
+    }
+    auto c = std::make_shared<StreamClient>();
+    c->framing = StreamFraming::WebSocket;
+    c->owns_fd = false;
+    if (!parse_subscription(req, *c)) {
+        http_error(conn, 400, "Unknown topic in 'topics'");
+        return;
+    }
+    if (g_streams.full()) {
+        http_error(conn, 503, "Too many stream subscribers");
+        return;
+    }
+    // From here on the hub does all writing, starting with the handshake; the
+    // reactor keeps reading.
+    c->out = std::make_shared<const std::string>(
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + ws_accept_key(key) + "\r\n\r\n");
+    c->fd = conn.fd;
+    g_streams.add(c);
+    conn.keep_alive = true;
+    conn.on_close = [c]() { g_streams.remove(c); };
+    conn.upgrade = [c](Connection& conn) { return ws_on_data(conn, c); };
+}
+
+template <typename T>
+Json::Value slot_diagnostics(const SensorSlot<T>& slot) {
+    Json::Value v;
+    v["version"] = (Json::UInt64)slot.version();
+    v["publish"] = slot.publish_time.to_json();
+    v["snapshot"] = slot.snapshot_time.to_json();
+    v["callback_delay"] = slot.callback_delay.to_json();
+    return v;
+}
 
-void handle_status(int client_sock) {
+// /diagnostics GET: synchronisation timings of the status store
+void handle_diagnostics(Connection& conn, Robot& robot) {
+    const RobotStatus& s = robot.status;
     Json::Value root;
-    {
-        std::lock_guard<std::mutex> lk(g_status.mtx);
-
-        // Battery
-        root["battery"] = g_status.battery_ready ? g_status.battery : Json::Value();
-
-        // Odometry
-        if (g_status.odom_ready) {
-            const auto& o = g_status.odom;
-            root["odometry"]["x"] = o.pose.pose.position.x;
-            root["odometry"]["y"] = o.pose.pose.position.y;
-            root["odometry"]["z"] = o.pose.pose.position.z;
-            root["odometry"]["orientation"]["x"] = o.pose.pose.orientation.x;
-            root["odometry"]["orientation"]["y"] = o.pose.pose.orientation.y;
-            root["odometry"]["orientation"]["z"] = o.pose.pose.orientation.z;
-            root["odometry"]["orientation"]["w"] = o.pose.pose.orientation.w;
-            root["odometry"]["linear"]["x"] = o.twist.twist.linear.x;
-            root["odometry"]["linear"]["y"] = o.twist.twist.linear.y;
-            root["odometry"]["linear"]["z"] = o.twist.twist.linear.z;
-            root["odometry"]["angular"]["x"] = o.twist.twist.angular.x;
-            root["odometry"]["angular"]["y"] = o.twist.twist.angular.y;
-            root["odometry"]["angular"]["z"] = o.twist.twist.angular.z;
-        }
-        // IMU
-        if (g_status.imu_ready) {
-            const auto& i = g_status.imu;
-            root["imu"]["orientation"]["x"] = i.orientation.x;
-            root["imu"]["orientation"]["y"] = i.orientation.y;
-            root["imu"]["orientation"]["z"] = i.orientation.z;
-            root["imu"]["orientation"]["w"] = i.orientation.w;
-            root["imu"]["angular_velocity"]["x"] = i.angular_velocity.x;
-            root["imu"]["angular_velocity"]["y"] = i.angular_velocity.y;
-            root["imu"]["angular_velocity"]["z"] = i.angular_velocity.z;
-            root["imu"]["linear_acceleration"]["x"] = i.linear_acceleration.x;
-            root["imu"]["linear_acceleration"]["y"] = i.linear_acceleration.y;
-            root["imu"]["linear_acceleration"]["z"] = i.linear_acceleration.z;
-        }
-        // Lidar
-        if (g_status.lidar_ready) {
-            const auto& l = g_status.lidar;
-            for (float r : l.ranges) root["lidar"]["ranges"].append(r);
-            root["lidar"]["angle_min"] = l.angle_min;
-            root["lidar"]["angle_max"] = l.angle_max;
-            root["lidar"]["angle_increment"] = l.angle_increment;
-            root["lidar"]["time_increment"] = l.time_increment;
-            root["lidar"]["scan_time"] = l.scan_time;
-            root["lidar"]["range_min"] = l.range_min;
-            root["lidar"]["range_max"] = l.range_max;
-        }
-        // Camera
-        if (g_status.camera_ready) {
-            const auto& c = g_status.camera;
-            root["camera"]["width"] = c.width;
-            root["camera"]["height"] = c.height;
-            root["camera"]["encoding"] = c.encoding;
-            root["camera"]["step"] = c.step;
-            root["camera"]["data_len"] = (Json::UInt64)c.data.size();
-            // For brevity, do not include raw image bytes in status response
-        }
-    }
-    http_send_json(client_sock, root);
-}
-
-// Helper: Read all data for POST
-std::string read_http_body(int client_sock, int content_length) {
-    std::string body;
-    body.reserve(content_length);
-    int total = 0;
-    while (total < content_length) {
-        char buf[4096];
-        int to_read = std::min(4096, content_length - total);
-        int n = recv(client_sock, buf, to_read, 0);
-        if (n <= 0) break;
-        body.append(buf, n);
-        total += n;
+    root["slots"]["battery"] = slot_diagnostics(s.battery);
+    root["slots"]["odom"] = slot_diagnostics(s.odom);
+    root["slots"]["imu"] = slot_diagnostics(s.imu);
+    root["slots"]["lidar"] = slot_diagnostics(s.lidar);
+    root["slots"]["camera"] = slot_diagnostics(s.camera);
+    root["status_cache"]["lock_wait"] = robot.status_bodies[kFieldAll].lock_wait.to_json();
+    root["status_cache"]["lock_hold"] = robot.status_bodies[kFieldAll].lock_hold.to_json();
+    root["stream_clients"] = (Json::UInt64)g_streams.client_count();
+    root["velocity"] = robot.velocity.to_json();
+    http_send_json(conn, root);
+}
+
+// /robots GET: every served robot with the CPU time and memory it costs.
+// CPU is thread time in its callbacks and request handlers; memory is the
+// messages, history rings and response bodies it holds.
+void handle_robots(Connection& conn) {
+    Json::Value root(Json::arrayValue);
+    int64_t now = steady_ms();
+    for (auto& r : g_robots) {
+        const RobotStatus& s = r->status;
+        Json::Value v;
+        v["id"] = r->id;
+        v["namespace"] = r->ns.empty() ? "/" : r->ns;
+        v["messages"] = (Json::UInt64)status_version(s, kFieldAll);
+        int64_t last = std::max({s.battery.last_update_ms(), s.odom.last_update_ms(), s.imu.last_update_ms(),
+                                 s.lidar.last_update_ms(), s.camera.last_update_ms()});
+        if (last > 0) v["age_ms"] = (Json::Int64)(now - last);
+        else v["age_ms"] = Json::Value();
+        v["requests"] = (Json::UInt64)r->requests.load(std::memory_order_relaxed);
+        v["cpu_seconds"]["callbacks"] = s.callback_cpu_ns.load(std::memory_order_relaxed) / 1e9;
+        v["cpu_seconds"]["requests"] = r->request_cpu_ns.load(std::memory_order_relaxed) / 1e9;
+        size_t messages = s.message_bytes(), history = s.history.bytes(), bodies = r->body_bytes();
+        v["memory_bytes"]["messages"] = (Json::UInt64)messages;
+        v["memory_bytes"]["history"] = (Json::UInt64)history;
+        v["memory_bytes"]["bodies"] = (Json::UInt64)bodies;
+        v["memory_bytes"]["total"] = (Json::UInt64)(messages + history + bodies);
+        root.append(v);
     }
-    return body;
+    http_send_json(conn, root);
 }
 
-// Navigation command publisher (topic, type, etc. must match ROS system)
-ros::Publisher g_nav_pub;
-ros::Publisher g_move_pub;
+// Route labels for /metrics, one per endpoint.
+enum Route {
+    kRouteStatus, kRouteLidar, kRouteLidarSummary, kRouteCameraFrame, kRouteCameraStream, kRouteStream, kRouteWs, kRouteHistory,
+    kRouteDiagnostics, kRouteMetrics, kRouteNav, kRouteMove, kRouteTrajectory, kRouteRobots, kRouteNotFound,
+    kRouteInvalid, kRouteCount
+};
 
-// /nav POST: expects JSON body with fields: "points" (array of [x,y]), "algorithm" ("dijkstra" or "astar")
-void handle_nav(int client_sock, const std::string& body) {
-    Json::Value req;
-    Json::Reader jr;
-    if (!jr.parse(body, req)) {
-        http_error(client_sock, 400, "Invalid JSON");
-        return;
+const char* const g_route_names[kRouteCount] = {
+    "status", "lidar", "lidar_summary", "camera_frame", "camera_stream", "stream", "ws", "history",
+    "diagnostics", "metrics", "nav", "move", "trajectory", "robots", "not_found", "invalid",
+};
+
+// Time from a complete request to its response being written (or, for
+// streams, handed to the hub), per route.
+Histogram g_route_latency[kRouteCount];
+
+// LatencyStat as a summary without quantiles (_sum in seconds and _count).
+inline void prom_latency(std::string& out, const char* name, const std::string& labels, const LatencyStat& s) {
+    std::string sum = std::string(name) + "_sum", count = std::string(name) + "_count";
+    prom_sample(out, sum.c_str(), labels, s.total_ns.load(std::memory_order_relaxed) / 1e9);
+    prom_sample(out, count.c_str(), labels, (double)s.count.load(std::memory_order_relaxed));
+}
+
+// Label selecting one robot's series. A single-robot driver leaves it out,
+// so its series keep the names they had before robots were sharded.
+inline std::string robot_label(const Robot& robot, const char* more = "") {
+    if (g_robots.size() == 1) return more;
+    return "robot=\"" + robot.id + "\"" + (*more ? "," : "") + more;
+}
+
+// Per-sensor series of one slot; `label` selects the robot and topic.
+template <typename T>
+void slot_metrics(std::string (&out)[6], const std::string& label, const SensorSlot<T>& slot, int64_t now_ms) {
+    prom_sample(out[0], "wheeltec_messages_total", label, (double)slot.version());
+    if (slot.version() > 0) prom_sample(out[1], "wheeltec_sensor_age_seconds", label, (now_ms - slot.last_update_ms()) / 1e3);
+    slot.callback_time.write(out[2], "wheeltec_callback_duration_seconds", label);
+    prom_latency(out[3], "wheeltec_callback_delay_seconds", label, slot.callback_delay);
+    prom_latency(out[4], "wheeltec_slot_publish_seconds", label, slot.publish_time);
+    prom_latency(out[5], "wheeltec_slot_snapshot_seconds", label, slot.snapshot_time);
+}
+
+// /metrics GET: Prometheus text exposition. Every series is read from
+// relaxed atomics, so scraping never blocks the request or ROS threads.
+void handle_metrics(Connection& conn) {
+    std::string out;
+    out.reserve(16384);
+
+    prom_header(out, "wheeltec_http_request_duration_seconds", "histogram",
+                "Time from a complete request to its response, by route.");
+    for (int r = 0; r < kRouteCount; ++r)
+        g_route_latency[r].write(out, "wheeltec_http_request_duration_seconds",
+                                 std::string("route=\"") + g_route_names[r] + "\"");
+    prom_header(out, "wheeltec_http_sent_bytes_total", "counter", "Bytes written to HTTP, stream and WebSocket clients.");
+    prom_sample(out, "wheeltec_http_sent_bytes_total", "", (double)g_metrics.bytes_sent.load());
+    prom_header(out, "wheeltec_http_connections", "gauge", "Open HTTP connections (excluding streams).");
+    prom_sample(out, "wheeltec_http_connections", "", (double)g_metrics.connections_open.load());
+    prom_header(out, "wheeltec_http_connections_accepted_total", "counter", "Accepted HTTP connections.");
+    prom_sample(out, "wheeltec_http_connections_accepted_total", "", (double)g_metrics.connections_accepted.load());
+    prom_header(out, "wheeltec_http_connections_rejected_total", "counter", "Connections refused with 503 at the cap.");
+    prom_sample(out, "wheeltec_http_connections_rejected_total", "", (double)g_metrics.connections_rejected.load());
+    prom_header(out, "wheeltec_stream_clients", "gauge", "Connected SSE, WebSocket and MJPEG clients.");
+    prom_sample(out, "wheeltec_stream_clients", "", (double)g_streams.client_count());
+
+    // Sensor slots: one block per metric family, one series per topic.
+    static const char* const families[6][3] = {
+        {"wheeltec_messages_total", "counter", "Messages received per topic."},
+        {"wheeltec_sensor_age_seconds", "gauge", "Time since the topic's last message."},
+        {"wheeltec_callback_duration_seconds", "histogram", "Subscriber callback run time."},
+        {"wheeltec_callback_delay_seconds", "summary", "Message receipt to callback start."},
+        {"wheeltec_slot_publish_seconds", "summary", "Time to swap a new message into the status store."},
+        {"wheeltec_slot_snapshot_seconds", "summary", "Time for a reader to load a message from the status store."},
+    };
+    std::string series[6];
+    int64_t now = steady_ms();
+    for (auto& r : g_robots) {
+        const RobotStatus& s = r->status;
+        slot_metrics(series, robot_label(*r, "topic=\"battery\""), s.battery, now);
+        slot_metrics(series, robot_label(*r, "topic=\"odom\""), s.odom, now);
+        slot_metrics(series, robot_label(*r, "topic=\"imu\""), s.imu, now);
+        slot_metrics(series, robot_label(*r, "topic=\"lidar\""), s.lidar, now);
+        slot_metrics(series, robot_label(*r, "topic=\"camera\""), s.camera, now);
     }
-    if (!req.isMember("points") || !req["points"].isArray()) {
-        http_error(client_sock, 400, "Missing 'points' array");
-        return;
+    for (int f = 0; f < 6; ++f) {
+        prom_header(out, families[f][0], families[f][1], families[f][2]);
+        out += series[f];
     }
-    std::string algorithm = req.get("algorithm", "dijkstra").asString();
 
-    std_msgs::String msg;
-    Json::FastWriter fw;
-    msg.data = fw.write(req);
-    g_nav_pub.publish(msg);
+    prom_header(out, "wheeltec_status_cache_lock_wait_seconds", "summary", "Wait for the /status rebuild lock.");
+    for (auto& r : g_robots)
+        prom_latency(out, "wheeltec_status_cache_lock_wait_seconds", robot_label(*r), r->status_bodies[kFieldAll].lock_wait);
+    prom_header(out, "wheeltec_status_cache_lock_hold_seconds", "summary", "Time the /status rebuild lock is held.");
+    for (auto& r : g_robots)
+        prom_latency(out, "wheeltec_status_cache_lock_hold_seconds", robot_label(*r), r->status_bodies[kFieldAll].lock_hold);
 
-    Json::Value resp;
-    resp["status"] = "ok";
-    resp["algorithm"] = algorithm;
-    http_send_json(client_sock, resp);
+    // Teleop: one block per metric family, one series per robot.
+    std::string commands, published, deadman;
+    for (auto& r : g_robots) {
+        Json::Value vel = r->velocity.to_json();
+        for (const char* k : {"submitted", "coalesced"})
+            prom_sample(commands, "wheeltec_cmd_vel_commands_total",
+                        robot_label(*r, (std::string("outcome=\"") + k + "\"").c_str()), vel[k].asDouble());
+        prom_sample(published, "wheeltec_cmd_vel_published_total", robot_label(*r), vel["published"].asDouble());
+        prom_sample(deadman, "wheeltec_cmd_vel_deadman_stops_total", robot_label(*r), vel["deadman_stops"].asDouble());
+    }
+    prom_header(out, "wheeltec_cmd_vel_commands_total", "counter", "Teleop commands by outcome.");
+    out += commands;
+    prom_header(out, "wheeltec_cmd_vel_published_total", "counter", "Twists published to /cmd_vel by the coalescer.");
+    out += published;
+    prom_header(out, "wheeltec_cmd_vel_deadman_stops_total", "counter", "Zero twists sent after the deadman timeout.");
+    out += deadman;
+
+    // Per-robot cost, always labelled with the robot.
+    prom_header(out, "wheeltec_robot_cpu_seconds_total", "counter",
+                "Thread CPU time spent on a robot, in subscriber callbacks or request handlers.");
+    for (auto& r : g_robots) {
+        std::string robot = "robot=\"" + r->id + "\"";
+        prom_sample(out, "wheeltec_robot_cpu_seconds_total", robot + ",source=\"callbacks\"",
+                    r->status.callback_cpu_ns.load(std::memory_order_relaxed) / 1e9);
+        prom_sample(out, "wheeltec_robot_cpu_seconds_total", robot + ",source=\"requests\"",
+                    r->request_cpu_ns.load(std::memory_order_relaxed) / 1e9);
+    }
+    prom_header(out, "wheeltec_robot_memory_bytes", "gauge",
+                "Memory held for a robot: latest messages, history rings and cached response bodies.");
+    for (auto& r : g_robots) {
+        std::string robot = "robot=\"" + r->id + "\"";
+        prom_sample(out, "wheeltec_robot_memory_bytes", robot + ",kind=\"messages\"", (double)r->status.message_bytes());
+        prom_sample(out, "wheeltec_robot_memory_bytes", robot + ",kind=\"history\"", (double)r->status.history.bytes());
+        prom_sample(out, "wheeltec_robot_memory_bytes", robot + ",kind=\"bodies\"", (double)r->body_bytes());
+    }
+
+    std::string header = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+    http_send(conn, header, std::move(out));
 }
 
-// /move POST: expects JSON body with "linear" (float), "angular" (float)
-void handle_move(int client_sock, const std::string& body) {
-    Json::Value req;
-    Json::Reader jr;
-    if (!jr.parse(body, req)) {
-        http_error(client_sock, 400, "Invalid JSON");
-        return;
+// Routes served once per robot: at the top level for the default robot and
+// under /robots/{id}/ for every robot. `path` is relative to the robot.
+// Returns kRouteNotFound, having sent nothing, if no route matches.
+Route dispatch_robot(Connection& conn, const HttpRequest& req, Robot& robot, std::string_view path) {
+    if (req.method == "GET" && path == "/status") {
+        std::string_view list = query_param(req.query, "fields");
+        unsigned fields = list.empty() ? kFieldAll : parse_status_fields(list);
+        if (fields == 0) http_error(conn, 400, "Unknown field in 'fields'");
+        else handle_status(conn, req, robot, fields);
+        return kRouteStatus;
     }
-    if (!req.isMember("linear") || !req.isMember("angular")) {
-        http_error(client_sock, 400, "Missing 'linear' or 'angular'");
-        return;
+    if (req.method == "GET" && path.substr(0, 8) == "/status/" && status_field(path.substr(8))) {
+        handle_status(conn, req, robot, status_field(path.substr(8)));
+        return kRouteStatus;
     }
-    double linear = req["linear"].asDouble();
-    double angular = req["angular"].asDouble();
+    if (req.method == "GET" && path == "/lidar") {
+        handle_lidar(conn, req, robot);
+        return kRouteLidar;
+    }
+    if (req.method == "GET" && path == "/lidar/summary") {
+        handle_lidar_summary(conn, req, robot);
+        return kRouteLidarSummary;
+    }
+    if (req.method == "GET" && path == "/camera/frame.jpg") {
+        handle_camera_frame(conn, req, robot);
+        return kRouteCameraFrame;
+    }
+    if (req.method == "GET" && path == "/history") {
+        handle_history(conn, req, robot);
+        return kRouteHistory;
+    }
+    if (req.method == "GET" && path == "/diagnostics") {
+        handle_diagnostics(conn, robot);
+        return kRouteDiagnostics;
+    }
+    if (req.method == "POST" && path == "/nav") {
+        handle_nav(conn, robot, req.body);
+        return kRouteNav;
+    }
+    if (req.method == "POST" && path == "/move") {
+        handle_move(conn, robot, req.body);
+        return kRouteMove;
+    }
+    if (path == "/trajectory") {
+        if (req.method == "POST") handle_trajectory_post(conn, robot, req.body);
+        else if (req.method == "GET") handle_trajectory_get(conn, robot);
+        else if (req.method == "DELETE") handle_trajectory_delete(conn, robot);
+        else http_error(conn, 405, "Use GET, POST or DELETE");
+        return kRouteTrajectory;
+    }
+    return kRouteNotFound;
+}
 
-    geometry_msgs::Twist msg;
-    msg.linear.x = linear;
-    msg.angular.z = angular;
-    g_move_pub.publish(msg);
+// dispatch_robot, charging the request's CPU time to the robot.
+inline Route serve_robot(Connection& conn, const HttpRequest& req, Robot& robot, std::string_view path) {
+    uint64_t cpu0 = thread_cpu_ns();
+    Route route = dispatch_robot(conn, req, robot, path);
+    if (route != kRouteNotFound) {
+        robot.requests.fetch_add(1, std::memory_order_relaxed);
+        robot.request_cpu_ns.fetch_add(thread_cpu_ns() - cpu0, std::memory_order_relaxed);
+    }
+    return route;
+}
 
-    Json::Value resp;
-    resp["status"] = "ok";
-    resp["linear"] = linear;
-    resp["angular"] = angular;
-    http_send_json(client_sock, resp);
-}
-
-// Parse HTTP request and route
-void http_router(int client_sock) {
-    char buf[BUFFER_SIZE];
-    int n = recv(client_sock, buf, sizeof(buf)-1, 0);
-    if (n <= 0) return;
-    buf[n] = 0;
-    std::string req(buf, n);
-
-    std::istringstream iss(req);
-    std::string method, path, ver;
-    iss >> method >> path >> ver;
-
-    // Read headers
-    std::map<std::string, std::string> headers;
-    std::string line;
-    int content_length = 0;
-    while (std::getline(iss, line) && line != "\r") {
-        if (line.empty() || line == "\n" || line == "\r\n") break;
-        auto pos = line.find(':');
-        if (pos != std::string::npos) {
-            std::string key = line.substr(0, pos);
-            std::string val = line.substr(pos+1);
-            while (!val.empty() && (val[0] == ' ' || val[0] == '\t')) val = val.substr(1);
-            val.erase(val.find_last_not_of("\r\n") + 1);
-            headers[key] = val;
-            if (key == "Content-Length") content_length = std::stoi(val);
-        }
-    }
-
-    // Handle endpoints
-    if (method == "GET" && path == "/status") {
-        handle_status(client_sock);
-    } else if (method == "POST" && path == "/nav") {
-        std::string body = read_http_body(client_sock, content_length);
-        handle_nav(client_sock, body);
-    } else if (method == "POST" && path == "/move") {
-        std::string body = read_http_body(client_sock, content_length);
-        handle_move(client_sock, body);
-    } else {
-        http_error(client_sock, 404, "Not found");
+Route http_dispatch(Connection& conn, const HttpRequest& req) {
+    std::string_view path = req.path;
+    if (path.substr(0, 8) == "/robots/") {
+        path.remove_prefix(8);
+        size_t slash = path.find('/');
+        Robot* robot = find_robot(path.substr(0, slash));
+        Route route = robot && slash != std::string_view::npos ? serve_robot(conn, req, *robot, path.substr(slash))
+                                                               : kRouteNotFound;
+        if (route == kRouteNotFound) http_error(conn, 404, robot ? "Not found" : "Unknown robot");
+        return route;
+    }
+    if (req.method == "GET" && path == "/robots") {
+        handle_robots(conn);
+        return kRouteRobots;
+    }
+    Route route = serve_robot(conn, req, default_robot(), path);
+    if (route != kRouteNotFound) return route;
+    if (req.method == "GET" && path == "/camera/stream.mjpg") {
+        handle_camera_stream(conn, req);
+        return kRouteCameraStream;
+    }
+    if (req.method == "GET" && path == "/stream") {
+        handle_stream(conn, req);
+        return kRouteStream;
     }
+    if (req.method == "GET" && path == "/ws") {
+        handle_ws(conn, req);
+        return kRouteWs;
+    }
+    if (req.method == "GET" && path == "/metrics") {
+        handle_metrics(conn);
+        return kRouteMetrics;
+    }
+    http_error(conn, 404, "Not found");
+    return kRouteNotFound;
+}
+
+// Serve every complete request in the buffer, in order, so pipelined requests
+// are answered back to back. Called with everything received so far; a
+// partially received request stays in the parser until more bytes arrive.
+// Stops after a response the socket could not take in full; the reactor
+// calls back once it has been flushed.
+ConnAction http_router(Connection& conn) {
+    if (conn.upgrade) return conn.upgrade(conn);
+    while (!conn.in.empty()) {
+        HttpParser::Result r = conn.parser.parse(conn.in.begin(), conn.in.size());
+        if (r == HttpParser::Result::Incomplete) break;
+        uint64_t t0 = steady_ns();
+        if (r == HttpParser::Result::Error) {
+            conn.keep_alive = false;
+            http_error(conn, conn.parser.error_status(), conn.parser.error_message());
+            g_route_latency[kRouteInvalid].observe(steady_ns() - t0);
+            return ConnAction::Close;
+        }
+        const HttpRequest& req = conn.parser.request();
+        conn.keep_alive = req.keep_alive;
+        Route route = http_dispatch(conn, req);
+        g_route_latency[route].observe(steady_ns() - t0);
+        if (conn.on_detach) return ConnAction::Detach;
+        if (conn.upgrade) {
+            conn.in.consume(conn.parser.consumed());
+            conn.parser.reset();
+            return conn.in.empty() ? ConnAction::KeepOpen : conn.upgrade(conn);
+        }
+        conn.in.consume(conn.parser.consumed());
+        conn.parser.reset();
+        if (!conn.keep_alive) return ConnAction::Close;
+        if (!conn.out.empty()) break;
+    }
+    return ConnAction::KeepOpen;
 }
 
+// ================ Fake Sensors ================
+
+// Synthetic sensor traffic for benchmarks and demos without a robot or ROS
+// master (WHEELTEC_FAKE_SENSORS=1). Messages go through the real subscriber
+// callbacks, so slots, history, streams and metrics behave as in production;
+// every robot gets the same messages.
+// Rates and sizes: FAKE_ODOM_HZ (odom, imu and battery), FAKE_SCAN_HZ,
+// FAKE_SCAN_BEAMS, FAKE_CAMERA_HZ, FAKE_IMAGE_WIDTH, FAKE_IMAGE_HEIGHT.
+class FakeSensorFeeder {
+public:
+    void start() {
+        m_odom_ms = 1000.0 / std::max(1, getenv_int("FAKE_ODOM_HZ", 50));
+        m_scan_ms = 1000.0 / std::max(1, getenv_int("FAKE_SCAN_HZ", 10));
+        m_camera_ms = 1000.0 / std::max(1, getenv_int("FAKE_CAMERA_HZ", 15));
+        m_beams = std::max(1, getenv_int("FAKE_SCAN_BEAMS", 720));
+        m_width = std::max(1, getenv_int("FAKE_IMAGE_WIDTH", 640));
+        m_height = std::max(1, getenv_int("FAKE_IMAGE_HEIGHT", 480));
+        m_running = true;
+        m_thread = std::thread(&FakeSensorFeeder::run, this);
+    }
+
+    void stop() {
+        m_running = false;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+private:
+    template <typename M>
+    static ros::MessageEvent<M const> event(const boost::shared_ptr<M>& msg) {
+        return ros::MessageEvent<M const>(msg, ros::Time::now());
+    }
+
+    void run() {
+        auto start = std::chrono::steady_clock::now();
+        double next_odom = 0, next_scan = 0, next_camera = 0;
+        uint32_t seq = 0;
+        while (m_running) {
+            double t = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            ros::Time stamp = ros::Time::now();
+            if (t >= next_odom) {
+                next_odom = std::max(next_odom + m_odom_ms, t);
+                feed_odom(stamp, t / 1000.0);
+            }
+            if (t >= next_scan) {
+                next_scan = std::max(next_scan + m_scan_ms, t);
+                feed_scan(stamp, seq);
+            }
+            if (t >= next_camera) {
+                next_camera = std::max(next_camera + m_camera_ms, t);
+                feed_camera(stamp, seq);
+            }
+            ++seq;
+            double wake = std::min(next_odom, std::min(next_scan, next_camera));
+            std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>(wake * 1000)));
+        }
+    }
+
+    // Drives a 1 m circle at 0.2 m/s.
+    void feed_odom(const ros::Time& stamp, double s) {
+        const double w = 0.2;
+        auto odom = boost::make_shared<nav_msgs::Odometry>();
+        odom->header.stamp = stamp;
+        odom->header.frame_id = "odom";
+        odom->pose.pose.position.x = std::cos(w * s);
+        odom->pose.pose.position.y = std::sin(w * s);
+        double yaw = w * s + M_PI / 2;
+        odom->pose.pose.orientation.z = std::sin(yaw / 2);
+        odom->pose.pose.orientation.w = std::cos(yaw / 2);
+        odom->twist.twist.linear.x = w;
+        odom->twist.twist.angular.z = w;
+        for (auto& r : g_robots) odom_cb(r->status, event(odom));
+
+        auto imu = boost::make_shared<sensor_msgs::Imu>();
+        imu->header.stamp = stamp;
+        imu->orientation = odom->pose.pose.orientation;
+        imu->angular_velocity.z = w;
+        imu->linear_acceleration.y = w * w;
+        imu->linear_acceleration.z = 9.81;
+        for (auto& r : g_robots) imu_cb(r->status, event(imu));
+
+        auto battery = boost::make_shared<std_msgs::Float32>();
+        battery->data = static_cast<float>(12.6 - std::fmod(s, 3600.0) * 1e-4);
+        for (auto& r : g_robots) battery_cb(r->status, event(battery));
+    }
+
+    void feed_scan(const ros::Time& stamp, uint32_t seq) {
+        auto scan = boost::make_shared<sensor_msgs::LaserScan>();
+        scan->header.stamp = stamp;
+        scan->header.frame_id = "laser";
+        scan->angle_min = -M_PI;
+        scan->angle_max = M_PI;
+        scan->angle_increment = 2 * M_PI / m_beams;
+        scan->scan_time = m_scan_ms / 1000.0;
+        scan->time_increment = scan->scan_time / m_beams;
+        scan->range_min = 0.1f;
+        scan->range_max = 12.0f;
+        scan->ranges.resize(m_beams);
+        for (int i = 0; i < m_beams; ++i) {
+            if (i % 97 == 0) scan->ranges[i] = std::numeric_limits<float>::infinity();
+            else scan->ranges[i] = 2.0f + 1.5f * std::sin(0.05f * (i + seq));
+        }
+        for (auto& r : g_robots) lidar_cb(r->status, event(scan));
+    }
+
+    void feed_camera(const ros::Time& stamp, uint32_t seq) {
+        auto img = boost::make_shared<sensor_msgs::Image>();
+        img->header.stamp = stamp;
+        img->header.frame_id = "camera";
+        img->width = m_width;
+        img->height = m_height;
+        img->encoding = "rgb8";
+        img->step = m_width * 3;
+        img->data.resize((size_t)img->step * m_height);
+        for (int y = 0; y < m_height; ++y) {
+            uint8_t* row = &img->data[(size_t)y * img->step];
+            for (int x = 0; x < m_width; ++x) {
+                row[3 * x] = static_cast<uint8_t>(x + seq);
+                row[3 * x + 1] = static_cast<uint8_t>(y);
+                row[3 * x + 2] = static_cast<uint8_t>(seq * 4);
+            }
+        }
+        for (auto& r : g_robots) camera_cb(r->status, event(img));
+    }
+
+    double m_odom_ms = 20, m_scan_ms = 100, m_camera_ms = 66;
+    int m_beams = 720, m_width = 640, m_height = 480;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+};
+
 // ================ Main Entry ================
 
 std::atomic<bool> running(true);
@@ -355,43 +4022,175 @@ void signal_handler(int sig) {
     running = false;
 }
 
+// Subscription settings for one sensor, from <PREFIX>_TOPIC,
+// <PREFIX>_QUEUE_SIZE and <PREFIX>_TRANSPORT. Transports: "tcp",
+// "tcp_nodelay" (no Nagle batching) and "udp" (UDPROS, falling back to
+// TCPROS with TCP_NODELAY if the publisher does not offer it).
+struct TopicConfig {
+    std::string topic;
+    int queue_size;
+    ros::TransportHints hints;
+};
+
+TopicConfig topic_config(const std::string& prefix, const char* default_topic, const char* default_transport) {
+    TopicConfig cfg;
+    cfg.topic = getenv_default((prefix + "_TOPIC").c_str(), default_topic);
+    cfg.queue_size = std::max(1, getenv_int((prefix + "_QUEUE_SIZE").c_str(), 1));
+    std::string transport = getenv_default((prefix + "_TRANSPORT").c_str(), default_transport);
+    if (transport != "tcp" && transport != "tcp_nodelay" && transport != "udp") {
+        ROS_WARN("%s_TRANSPORT=%s is not tcp, tcp_nodelay or udp; using %s", prefix.c_str(), transport.c_str(),
+                 default_transport);
+        transport = default_transport;
+    }
+    if (transport == "udp") cfg.hints = ros::TransportHints().unreliable().reliable().tcpNoDelay();
+    else if (transport == "tcp_nodelay") cfg.hints = ros::TransportHints().tcpNoDelay();
+    ROS_INFO("Subscribing to %s (queue %d, %s)", cfg.topic.c_str(), cfg.queue_size, transport.c_str());
+    return cfg;
+}
+
+// Subscribes `cb` to `cfg.topic` inside `ns`, feeding `robot`'s shard.
+template <typename M>
+ros::Subscriber subscribe_robot(ros::NodeHandle& nh, const TopicConfig& cfg, const std::string& ns,
+                                RobotStatus& robot,
+                                void (*cb)(RobotStatus&, const ros::MessageEvent<M const>&)) {
+    using Event = const ros::MessageEvent<M const>&;
+    boost::function<void(Event)> fn = [&robot, cb](Event ev) { cb(robot, ev); };
+    return nh.subscribe<M, Event>(robot_topic(ns, cfg.topic), cfg.queue_size, fn, ros::VoidConstPtr(), cfg.hints);
+}
+
+// Subscriptions, publishers and spinners for every robot. Light topics share
+// the global queue; scan and camera callbacks (encoding, stream fan-out) get
+// their own queues and spinner threads so they cannot hold up odometry.
+struct RosConnection {
+    ros::NodeHandle nh, scan_nh, camera_nh;
+    ros::CallbackQueue scan_queue, camera_queue;
+    std::vector<ros::Subscriber> subs;
+    ros::AsyncSpinner spinner, scan_spinner, camera_spinner;
+
+    RosConnection()
+        : spinner(std::max(1, getenv_int("ROS_SPINNER_THREADS", 2))),
+          scan_spinner(1, &scan_queue),
+          camera_spinner(1, &camera_queue) {
+        scan_nh.setCallbackQueue(&scan_queue);
+        camera_nh.setCallbackQueue(&camera_queue);
+        // Small high-rate messages default to TCP_NODELAY; see topic_config.
+        TopicConfig battery = topic_config("BATTERY", "/battery", "tcp_nodelay");
+        TopicConfig odom = topic_config("ODOM", "/odom", "tcp_nodelay");
+        TopicConfig imu = topic_config("IMU", "/imu", "tcp_nodelay");
+        TopicConfig scan = topic_config("SCAN", "/scan", "tcp");
+        TopicConfig camera = topic_config("CAMERA", "/camera/rgb/image_raw", "tcp");
+        for (auto& r : g_robots) {
+            subs.push_back(subscribe_robot(nh, battery, r->ns, r->status, battery_cb));
+            subs.push_back(subscribe_robot(nh, odom, r->ns, r->status, odom_cb));
+            subs.push_back(subscribe_robot(nh, imu, r->ns, r->status, imu_cb));
+            subs.push_back(subscribe_robot(scan_nh, scan, r->ns, r->status, lidar_cb));
+            subs.push_back(subscribe_robot(camera_nh, camera, r->ns, r->status, camera_cb));
+
+            // ROS Publishers
+            r->nav_pub = nh.advertise<std_msgs::String>(robot_topic(r->ns, "/nav_cmd"), 1);
+            r->move_pub = nh.advertise<geometry_msgs::Twist>(robot_topic(r->ns, "/cmd_vel"), 1);
+        }
+    }
+
+    // Callbacks run on spinner threads as soon as messages arrive.
+    void start() {
+        spinner.start();
+        scan_spinner.start();
+        camera_spinner.start();
+    }
+
+    void stop() {
+        spinner.stop();
+        scan_spinner.stop();
+        camera_spinner.stop();
+    }
+};
+
 int main(int argc, char** argv) {
     // Load config from environment
     std::string ROS_MASTER_URI = getenv_default("ROS_MASTER_URI", "http://localhost:11311");
     std::string ROS_HOSTNAME = getenv_default("ROS_HOSTNAME", "localhost");
     std::string HTTP_SERVER_HOST = getenv_default("HTTP_SERVER_HOST", "0.0.0.0");
     int HTTP_SERVER_PORT = getenv_int("HTTP_SERVER_PORT", 8080);
+    bool fake_sensors = getenv_int("WHEELTEC_FAKE_SENSORS", 0) != 0;
 
-    // Set ROS env
-    setenv("ROS_MASTER_URI", ROS_MASTER_URI.c_str(), 1);
-    setenv("ROS_HOSTNAME", ROS_HOSTNAME.c_str(), 1);
+    g_jpeg_quality = std::min(100, std::max(1, getenv_int("CAMERA_JPEG_QUALITY", 80)));
+    g_compression_level = std::min(9, std::max(0, getenv_int("HTTP_COMPRESSION_LEVEL", 6)));
+    g_compression_min_bytes = std::max(0, getenv_int("HTTP_COMPRESSION_MIN_BYTES", 1024));
+    g_lidar_sectors = std::min((int)kMaxLidarSectors, std::max(1, getenv_int("LIDAR_SUMMARY_SECTORS", 8)));
 
-    ros::init(argc, argv, "wheeltec_http_driver");
-    ros::NodeHandle nh;
+    // Served robots: WHEELTEC_ROBOTS=id1,id2 serves each id from the ROS
+    // namespace /<id>; unset, one robot on the global topics.
+    std::string robot_ids = getenv_default("WHEELTEC_ROBOTS", "");
+    for (size_t pos = 0; pos < robot_ids.size();) {
+        size_t comma = std::min(robot_ids.find(',', pos), robot_ids.size());
+        std::string_view id = std::string_view(robot_ids).substr(pos, comma - pos);
+        pos = comma + 1;
+        while (!id.empty() && std::isspace((unsigned char)id.front())) id.remove_prefix(1);
+        while (!id.empty() && std::isspace((unsigned char)id.back())) id.remove_suffix(1);
+        if (id.empty()) continue;
+        if (!valid_robot_id(id)) {
+            std::fprintf(stderr, "WHEELTEC_ROBOTS: invalid robot id '%.*s' (expected a letter, then letters, digits "
+                                 "or '_')\n", (int)id.size(), id.data());
+            return 1;
+        }
+        if (find_robot(id)) continue;
+        g_robots.emplace_back(new Robot(std::string(id), "/" + std::string(id)));
+    }
+    if (g_robots.empty()) g_robots.emplace_back(new Robot("default", ""));
+    // Streams and the MJPEG feed carry the robot served at the top level.
+    default_robot().status.streamed = true;
 
-    // ROS Subscribers
-    ros::Subscriber battery_sub = nh.subscribe("/battery", 1, battery_cb);
-    ros::Subscriber odom_sub = nh.subscribe("/odom", 1, odom_cb);
-    ros::Subscriber imu_sub = nh.subscribe("/imu", 1, imu_cb);
-    ros::Subscriber lidar_sub = nh.subscribe("/scan", 1, lidar_cb);
-    ros::Subscriber camera_sub = nh.subscribe("/camera/rgb/image_raw", 1, camera_cb);
+    // Per-topic sample history for /history
+    size_t history_capacity = std::max(16, getenv_int("HISTORY_CAPACITY", 4096));
+    for (auto& r : g_robots) r->status.history.init(history_capacity);
 
-    // ROS Publishers
-    g_nav_pub = nh.advertise<std_msgs::String>("/nav_cmd", 1);
-    g_move_pub = nh.advertise<geometry_msgs::Twist>("/cmd_vel", 1);
+    // Either a ROS node, or no ROS at all: the fake feeder only needs the clock.
+    std::unique_ptr<RosConnection> ros_conn;
+    FakeSensorFeeder feeder;
+    if (fake_sensors) {
+        ros::Time::init();
+    } else {
+        // Set ROS env
+        setenv("ROS_MASTER_URI", ROS_MASTER_URI.c_str(), 1);
+        setenv("ROS_HOSTNAME", ROS_HOSTNAME.c_str(), 1);
+        ros::init(argc, argv, "wheeltec_http_driver");
+        ros_conn.reset(new RosConnection());
+    }
 
     // HTTP Server
-    HttpServer server(HTTP_SERVER_HOST, HTTP_SERVER_PORT);
+    HttpServer::Options http_opts;
+    http_opts.backlog = getenv_int("HTTP_LISTEN_BACKLOG", 1024);
+    http_opts.max_connections = getenv_int("HTTP_MAX_CONNECTIONS", 1024);
+    http_opts.workers = getenv_int("HTTP_WORKER_THREADS", std::max(2, (int)std::thread::hardware_concurrency()));
+    http_opts.idle_timeout_ms = getenv_int("HTTP_KEEPALIVE_TIMEOUT_MS", 10000);
+    HttpServer server(HTTP_SERVER_HOST, HTTP_SERVER_PORT, http_opts);
+    // Everything the handlers hand work to runs before the first request is
+    // accepted, and is stopped only after the server.
+    g_streams.start(getenv_int("STREAM_MAX_CLIENTS", 256));
+    int cmd_vel_hz = std::max(1, getenv_int("CMD_VEL_RATE_HZ", 20));
+    int deadman_ms = std::max(1, getenv_int("CMD_VEL_DEADMAN_MS", 500));
+    int trajectory_priority = getenv_int("TRAJECTORY_RT_PRIORITY", 0);
+    for (auto& r : g_robots) {
+        r->velocity.start(r->move_pub, cmd_vel_hz, deadman_ms);
+        r->trajectory.start(r->move_pub, trajectory_priority);
+    }
     server.start(http_router);
 
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
 
-    // Spin in ROS + keep HTTP server running
-    while (ros::ok() && running) {
-        ros::spinOnce();
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-    }
+    if (ros_conn) ros_conn->start();
+    else feeder.start();
+
+    while (running && (!ros_conn || ros::ok())) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (ros_conn) ros_conn->stop();
+    else feeder.stop();
     server.stop();
+    g_streams.stop();
+    for (auto& r : g_robots) {
+        r->velocity.stop();
+        r->trajectory.stop();
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,133 @@
+// Streaming JSON writer for the fixed-schema telemetry bodies.
+//
+// Appends straight into a caller-owned std::string; with the string reserved
+// up front nothing else is allocated. Numbers are spelled as Json::FastWriter
+// spells them, so with object keys emitted in sorted order (as jsoncpp does)
+// the output is byte-identical to the jsoncpp tree it replaces:
+//   - doubles as printf "%.17g" (via std::to_chars, which is locale-free),
+//     with ".0" appended to integral values,
+//   - NaN as null and +/-inf as +/-1e+9999.
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : m_out(out) {}
+
+    void begin_object() { open('{'); }
+    void end_object() { close('}'); }
+    void begin_array() { open('['); }
+    void end_array() { close(']'); }
+
+    // Key of the next object member; `k` is written as is (plain ASCII).
+    void key(std::string_view k) {
+        separate();
+        m_out += '"';
+        m_out.append(k.data(), k.size());
+        m_out += "\":";
+        m_after_key = true;
+    }
+
+    void value(double v) {
+        separate();
+        if (std::isnan(v)) {
+            m_out += "null";
+            return;
+        }
+        if (std::isinf(v)) {
+            m_out += v < 0 ? "-1e+9999" : "1e+9999";
+            return;
+        }
+        char buf[32];
+        char* end = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::general, 17).ptr;
+        m_out.append(buf, end - buf);
+        if (!std::memchr(buf, '.', end - buf) && !std::memchr(buf, 'e', end - buf)) m_out += ".0";
+    }
+
+    void value(uint64_t v) { integer(v); }
+    void value(int64_t v) { integer(v); }
+    void value(uint32_t v) { integer(v); }
+    void value(int v) { integer(v); }
+
+    void value(bool v) {
+        separate();
+        m_out += v ? "true" : "false";
+    }
+
+    void value(std::string_view s) {
+        separate();
+        m_out += '"';
+        for (char c : s) {
+            switch (c) {
+            case '"': m_out += "\\\""; break;
+            case '\\': m_out += "\\\\"; break;
+            case '\b': m_out += "\\b"; break;
+            case '\f': m_out += "\\f"; break;
+            case '\n': m_out += "\\n"; break;
+            case '\r': m_out += "\\r"; break;
+            case '\t': m_out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    char esc[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+                    m_out.append(esc, sizeof(esc));
+                } else {
+                    m_out += c;
+                }
+            }
+        }
+        m_out += '"';
+    }
+    void value(const char* s) { value(std::string_view(s)); }
+
+    void null() {
+        separate();
+        m_out += "null";
+    }
+
+    // True while the innermost open container has no elements. FastWriter
+    // prints a root object that never got a member as null.
+    bool empty() const { return m_first[m_depth]; }
+
+private:
+    static const int kMaxDepth = 16;
+
+    template <typename I>
+    void integer(I v) {
+        separate();
+        char buf[24];
+        m_out.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr - buf);
+    }
+
+    // Comma before every element but the first of its container.
+    void separate() {
+        if (m_after_key) {
+            m_after_key = false;
+            return;
+        }
+        if (!m_first[m_depth]) m_out += ',';
+        m_first[m_depth] = false;
+    }
+
+    void open(char c) {
+        separate();
+        m_out += c;
+        m_first[++m_depth] = true;
+    }
+
+    void close(char c) {
+        m_out += c;
+        --m_depth;
+    }
+
+    std::string& m_out;
+    int m_depth = 0;
+    bool m_first[kMaxDepth + 1] = {true};
+    bool m_after_key = false;
+};